@@ -0,0 +1,125 @@
+/*---------------------------------------------------------*\
+| AMBXCommandRing.h                                         |
+|                                                           |
+|   Bounded lock-free command ring for Philips amBX Gaming  |
+|   lights                                                  |
+|                                                           |
+|   Any number of threads push commands, one thread (the    |
+|   device's writer) pops them. Every slot carries a        |
+|   sequence number that tells producers and the consumer  |
+|   whose turn it is, so neither side takes a lock. Each    |
+|   producer's commands come out in the order it pushed     |
+|   them. A push into a full ring fails instead of waiting. |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+template<typename T, unsigned int capacity>
+class AMBXCommandRing
+{
+    static_assert((capacity & (capacity - 1)) == 0, "AMBXCommandRing capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "AMBXCommandRing entries are copied in and out");
+
+public:
+    AMBXCommandRing()
+    {
+        for(unsigned int slot_idx = 0; slot_idx < capacity; slot_idx++)
+        {
+            slots[slot_idx].sequence.store(slot_idx, std::memory_order_relaxed);
+        }
+        
+        push_position.store(0, std::memory_order_relaxed);
+        pop_position = 0;
+    }
+    
+    /*-----------------------------------------------------*\
+    | Safe from any thread. Returns false if the ring is    |
+    | full, leaving it unchanged.                           |
+    \*-----------------------------------------------------*/
+    bool Push(const T& entry)
+    {
+        unsigned int position = push_position.load(std::memory_order_relaxed);
+        
+        while(true)
+        {
+            ring_slot&   slot = slots[position & (capacity - 1)];
+            unsigned int turn = slot.sequence.load(std::memory_order_acquire);
+            int          lag  = (int)(turn - position);
+            
+            if(lag == 0)
+            {
+                // The slot is free for this position, claim it before another producer does
+                if(push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.entry = entry;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(lag < 0)
+            {
+                // The consumer has not freed this slot from the previous lap yet
+                return false;
+            }
+            else
+            {
+                position = push_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    /*-----------------------------------------------------*\
+    | Consumer thread only. Returns false if the next       |
+    | entry has not been published yet.                     |
+    \*-----------------------------------------------------*/
+    bool Pop(T& entry)
+    {
+        ring_slot& slot = slots[pop_position & (capacity - 1)];
+        
+        if(slot.sequence.load(std::memory_order_acquire) != pop_position + 1)
+        {
+            return false;
+        }
+        
+        entry = slot.entry;
+        slot.sequence.store(pop_position + capacity, std::memory_order_release);
+        pop_position++;
+        
+        return true;
+    }
+    
+    /*-----------------------------------------------------*\
+    | Consumer thread only                                  |
+    \*-----------------------------------------------------*/
+    bool Empty()
+    {
+        return slots[pop_position & (capacity - 1)].sequence.load(std::memory_order_acquire) != pop_position + 1;
+    }
+
+private:
+    /*-----------------------------------------------------*\
+    | A slot whose sequence equals a push position is free  |
+    | for that push. Position + 1 means its entry is ready  |
+    | to pop, position + capacity frees it for the next lap.|
+    \*-----------------------------------------------------*/
+    struct ring_slot
+    {
+        std::atomic<unsigned int>   sequence;
+        T                           entry;
+    };
+    
+    ring_slot                       slots[capacity];
+    
+    /*-----------------------------------------------------*\
+    | Kept on separate cache lines so producers claiming    |
+    | slots do not slow down the consumer                   |
+    \*-----------------------------------------------------*/
+    alignas(64) std::atomic<unsigned int> push_position;
+    alignas(64) unsigned int        pop_position;
+};
@@ -8,341 +8,1918 @@
 \*---------------------------------------------------------*/
 
 #include "AMBXController.h"
-#include "LogManager.h"
+#include "AMBXTrace.h"
+#include "AMBXUSBTransport.h"
+#include "AMBXLog.h"
+#include <algorithm>
+#include <bitset>
+#include <cstdio>
 #include <cstring>
+#include <map>
 #include <thread>
 #include <chrono>
 
-AMBXController::AMBXController(const char* path)
+/*---------------------------------------------------------*\
+| Fills a sequence with even steps from one color to        |
+| another, ending on the target color                       |
+\*---------------------------------------------------------*/
+static void BuildFade(RGBColor from, RGBColor to, RGBColor* steps)
+{
+    for(int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
+    {
+        int red   = RGBGetRValue(from) + ((((int)RGBGetRValue(to) - (int)RGBGetRValue(from)) * (step + 1)) / AMBX_SEQUENCE_STEPS);
+        int green = RGBGetGValue(from) + ((((int)RGBGetGValue(to) - (int)RGBGetGValue(from)) * (step + 1)) / AMBX_SEQUENCE_STEPS);
+        int blue  = RGBGetBValue(from) + ((((int)RGBGetBValue(to) - (int)RGBGetBValue(from)) * (step + 1)) / AMBX_SEQUENCE_STEPS);
+        
+        steps[step] = ToRGBColor(red, green, blue);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Multi-command probe results by serial. Never destroyed,   |
+| so a writer thread opening its device at exit can still   |
+| use it.                                                   |
+\*---------------------------------------------------------*/
+typedef struct
+{
+    std::mutex                              mutex;
+    std::map<std::string, unsigned int>     commands;
+} ambx_multi_command_cache;
+
+static ambx_multi_command_cache& GetMultiCommandCache()
+{
+    static ambx_multi_command_cache* cache = new ambx_multi_command_cache;
+    
+    return *cache;
+}
+
+/*---------------------------------------------------------*\
+| Opens the amBX device at the given "bus-address" or       |
+| "bus-port.port" path                                      |
+\*---------------------------------------------------------*/
+AMBXController::AMBXController(const char* path) : AMBXController(new AMBXUSBTransport(path))
+{
+}
+
+/*---------------------------------------------------------*\
+| Takes ownership of the transport. With lazy_open the      |
+| device is opened by the writer thread in the background   |
+| instead of here, and only its serial is read up front.    |
+| With multi_command the device is probed at open for       |
+| taking a whole frame in one packet.                       |
+\*---------------------------------------------------------*/
+AMBXController::AMBXController(AMBXTransport* transport_ptr, bool lazy_open, bool multi_command)
+{
+    transport = transport_ptr;
+    initialized = false;
+    serial_known = false;
+    opened = false;
+    connected = false;
+    max_packet_size = 0;
+    this->multi_command = multi_command;
+    commands_per_packet = 1;
+    endpoint_changed = false;
+    writer_thread_run = false;
+    writer_thread_done = false;
+    writer_abort = false;
+    command_count = 0;
+    sequence_active = false;
+    sequence_changed = false;
+    barrier_changed = false;
+    sequence_step_ms = 0;
+    mailbox_pending = 0;
+    shadow_valid = 0;
+    wire_generation = 0;
+    wire_packet = 0;
+    packets_completed = 0;
+    probe_packet = 0;
+    probe_done = false;
+    probe_status = LIBUSB_TRANSFER_COMPLETED;
+    configured_min_gap_us = 0;
+    endpoint_interval_us = AMBX_PACING_MIN_GAP;
+    min_packet_gap_us = AMBX_PACING_MIN_GAP;
+    packet_gap_us = AMBX_PACING_INITIAL_GAP;
+    next_packet_time = std::chrono::steady_clock::now();
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        mailbox_colors[slot] = ToRGBColor(0, 0, 0);
+        shadow_colors[slot]  = ToRGBColor(0, 0, 0);
+    }
+    
+    // Set before any completion can log it
+    location = transport->GetLocation();
+    
+    // Completions and hotplug changes report back to this controller
+    transport->SetCompletionCallback(TransferCallback, this);
+    transport->SetConnectionCallback(ConnectionCallback, this);
+    
+    if(lazy_open)
+    {
+        // Assume the detected device can be opened until the writer thread gives up on it
+        initialized = true;
+        
+        // Read without claiming the device, so it is there when OpenRGB registers the device
+        serial       = transport->GetSerial();
+        serial_known = !serial.empty();
+        
+        StartWriterThread();
+        return;
+    }
+    
+    initialized = EnsureOpen();
+    
+    if(!initialized)
+    {
+        return;
+    }
+    
+    // Frames queued from OpenRGB are sent from here on
+    StartWriterThread();
+}
+
+AMBXController::~AMBXController()
+{
+    // Stop sending queued frames, any pending frame is dropped
+    StopWriterThread();
+    SetFrameBarrier(nullptr);
+    
+    // Nothing may call back into this controller once it is gone
+    transport->SetCompletionCallback(nullptr, nullptr);
+    transport->SetConnectionCallback(nullptr, nullptr);
+    
+    // Turn off all lights before closing
+    if(initialized && connected)
+    {
+        SendBlackout();
+    }
+    
+    // Closing waits for the blackout, which happens in the background alongside other devices
+    AMBXTransportReaper::Get().Reap(transport);
+}
+
+std::string AMBXController::GetDeviceLocation()
+{
+    return location;
+}
+
+std::string AMBXController::GetSerialString()
+{
+    // Unless read up front, not read from the device until it has been opened
+    if(!serial_known && !opened.load(std::memory_order_acquire))
+    {
+        return "";
+    }
+    
+    return serial;
+}
+
+/*---------------------------------------------------------*\
+| Function: EnsureOpen                                       |
+|                                                           |
+| Description: Opens the device on first use, reads its     |
+|              serial and endpoint limits, turns all of its |
+|              lights off and probes for multi-command      |
+|              packets if asked to. Later calls return at   |
+|              once. Only the constructor and the writer    |
+|              thread call it.                              |
+|                                                           |
+| Parameters:                                               |
+|   last_attempt - Whether a failure is final. Otherwise    |
+|                  the device stays unopened so the next    |
+|                  call tries again.                        |
+|                                                           |
+| Returns: true if the device is open                       |
+\*---------------------------------------------------------*/
+bool AMBXController::EnsureOpen(bool last_attempt)
+{
+    if(opened.load(std::memory_order_acquire))
+    {
+        return initialized;
+    }
+    
+    std::lock_guard<std::mutex> lock(open_mutex);
+    
+    if(opened.load(std::memory_order_relaxed))
+    {
+        return initialized;
+    }
+    
+    if(!transport->Open())
+    {
+        if(!last_attempt)
+        {
+            return false;
+        }
+        
+        AMBX_LOG_ERROR("Failed to initialize AMBX device - device not found or couldn't be accessed");
+        AMBX_LOG_ERROR("Check USB connections and permissions");
+        
+        initialized = false;
+        opened.store(true, std::memory_order_release);
+        return false;
+    }
+    
+    initialized = true;
+    connected   = true;
+    
+    if(!serial_known)
+    {
+        serial = transport->GetSerial();
+    }
+    
+    ReadEndpoint();
+    
+    /*-----------------------------------------------------*\
+    | Turn off all lights initially. The packet is sent     |
+    | directly, as the public setters would wait on this    |
+    | same open.                                            |
+    \*-----------------------------------------------------*/
+    unsigned char color_buf[6] = { AMBX_PACKET_HEADER, AMBX_LIGHT_ALL, AMBX_SET_COLOR, 0, 0, 0 };
+    
+    UpdateShadow(AMBX_LIGHT_ALL, ToRGBColor(0, 0, 0));
+    SendPacket(color_buf, sizeof(color_buf));
+    
+    commands_per_packet = ProbeMultiCommand();
+    
+    opened.store(true, std::memory_order_release);
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: OpenWithRetry                                    |
+|                                                           |
+| Description: Opens a lazily opened device from the writer |
+|              thread. A device that cannot be opened yet,  |
+|              for instance because it is still settling    |
+|              after detection, is tried again with a       |
+|              doubling delay. Frames published meanwhile   |
+|              wait in the mailbox. After the last attempt  |
+|              the controller is marked uninitialized.      |
+|                                                           |
+| Returns: true if the device is open                       |
+\*---------------------------------------------------------*/
+bool AMBXController::OpenWithRetry()
+{
+    unsigned int delay_ms = AMBX_OPEN_RETRY_DELAY;
+    
+    for(unsigned int attempt = 1; attempt < AMBX_OPEN_ATTEMPTS; attempt++)
+    {
+        if(EnsureOpen(false))
+        {
+            return true;
+        }
+        
+        AMBX_LOG_WARNING("Could not open amBX device at %s, trying again in %u ms", location.c_str(), delay_ms);
+        
+        std::unique_lock<std::mutex> lock(writer_mutex);
+        
+        if(writer_cv.wait_for(lock, std::chrono::milliseconds(delay_ms), [this]
+        {
+            return !writer_thread_run;
+        }))
+        {
+            return false;
+        }
+        
+        delay_ms *= 2;
+    }
+    
+    if(EnsureOpen(true))
+    {
+        return true;
+    }
+    
+    AMBX_LOG_ERROR("Gave up opening amBX device at %s after %d attempts, rescan devices to try again", location.c_str(), AMBX_OPEN_ATTEMPTS);
+    return false;
+}
+
+/*---------------------------------------------------------*\
+| Function: ReadEndpoint                                     |
+|                                                           |
+| Description: Takes the packet size and polling interval   |
+|              of the device's OUT endpoint. The device     |
+|              cannot take packets faster than it polls the |
+|              endpoint. Its packet size only limits how    |
+|              many commands are batched into one transfer. |
+|              Called when the device is opened and when a  |
+|              replugged device is attached, which may      |
+|              advertise different values.                  |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::ReadEndpoint()
+{
+    AMBXEndpointInfo endpoint = transport->GetOutEndpoint();
+    
+    max_packet_size = endpoint.max_packet_size;
+    
+    endpoint_interval_us = std::min(endpoint.interval_us, (unsigned int)AMBX_PACING_MAX_GAP);
+    UpdateMinimumPacketGap();
+    packet_gap_us = std::max(packet_gap_us.load(), min_packet_gap_us.load());
+}
+
+/*---------------------------------------------------------*\
+| Function: ProbeMultiCommand                                |
+|                                                           |
+| Description: Finds how many SET_COLOR commands to send in |
+|              one transfer. Unless the device's serial was |
+|              probed before, sends one packet of as many   |
+|              black commands as fit, up to one per light,  |
+|              and waits for it to complete. Only called    |
+|              while the lights are black, after the        |
+|              blackout at open or on the writer thread     |
+|              when a replugged device comes back dark.     |
+|                                                           |
+| Returns: Commands per transfer, 1 if the device rejected  |
+|          the probe or was not probed                      |
+\*---------------------------------------------------------*/
+unsigned int AMBXController::ProbeMultiCommand()
+{
+    unsigned int commands = std::min(max_packet_size / AMBX_COLOR_PACKET_SIZE, (unsigned int)AMBX_LIGHT_COUNT);
+    
+    if(!multi_command || commands < 2)
+    {
+        return 1;
+    }
+    
+    ambx_multi_command_cache& cache = GetMultiCommandCache();
+    
+    // Devices without a serial cannot be told apart, so they are probed every time
+    if(!serial.empty())
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        
+        std::map<std::string, unsigned int>::iterator cached = cache.commands.find(serial);
+        
+        // The same device may come back with a smaller endpoint
+        if(cached != cache.commands.end())
+        {
+            return std::min(cached->second, commands);
+        }
+    }
+    
+    /*-----------------------------------------------------*\
+    | The lights are already black, so they look the same   |
+    | whatever the device makes of the probe                |
+    \*-----------------------------------------------------*/
+    AMBXFrameBatch batch;
+    RGBColor       black[AMBX_LIGHT_COUNT] = {};
+    
+    BuildFrameBatch(batch, black, (1 << commands) - 1);
+    
+    {
+        std::lock_guard<std::mutex> lock(wire_mutex);
+        
+        probe_packet = stats.GetPacketsSubmitted() + 1;
+        probe_done   = false;
+    }
+    
+    SendPacket(batch.packets[0], commands * AMBX_COLOR_PACKET_SIZE);
+    
+    bool finished = true;
+    bool accepted;
+    
+    {
+        std::unique_lock<std::mutex> lock(wire_mutex);
+        
+        // A packet the transport refused never completes, which counts as rejected
+        if(stats.GetPacketsSubmitted() >= probe_packet)
+        {
+            probe_cv.wait_for(lock, std::chrono::milliseconds(AMBX_MULTI_COMMAND_PROBE_TIMEOUT), [this]
+            {
+                return probe_done;
+            });
+            
+            finished = probe_done;
+        }
+        
+        accepted     = probe_done && probe_status == LIBUSB_TRANSFER_COMPLETED;
+        probe_packet = 0;
+    }
+    
+    unsigned int result = accepted ? commands : 1;
+    
+    if(accepted)
+    {
+        AMBX_LOG_INFO("amBX device %s takes multi-command packets, sending %u commands per transfer", serial.c_str(), result);
+    }
+    else
+    {
+        AMBX_LOG_INFO("amBX device %s does not take multi-command packets", serial.c_str());
+    }
+    
+    // A probe that timed out says nothing about the firmware, so it is tried again on the next open
+    if(finished && !serial.empty())
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        
+        cache.commands[serial] = result;
+    }
+    
+    return result;
+}
+
+bool AMBXController::IsInitialized()
+{
+    return initialized;
+}
+
+unsigned int AMBXController::GetCommandsPerPacket()
+{
+    // Not known until the device has been opened
+    if(!opened.load(std::memory_order_acquire))
+    {
+        return 1;
+    }
+    
+    return commands_per_packet;
+}
+
+unsigned long long AMBXController::GetFramesSent()
+{
+    return stats.GetFrames();
+}
+
+unsigned long long AMBXController::GetPacketsSent()
+{
+    return stats.GetPacketsSubmitted();
+}
+
+unsigned long long AMBXController::GetPacketsSkipped()
+{
+    return stats.GetPacketsSkipped();
+}
+
+/*---------------------------------------------------------*\
+| Function: GetStats                                         |
+|                                                           |
+| Description: Reads the transfer counters and latency      |
+|              percentiles without taking any lock, so it   |
+|              can be polled from any thread while frames   |
+|              are going out                                |
+|                                                           |
+| Returns: The current statistics                           |
+\*---------------------------------------------------------*/
+AMBXStatsSnapshot AMBXController::GetStats()
+{
+    return stats.GetSnapshot();
+}
+
+/*---------------------------------------------------------*\
+| Function: SetFrameBarrier                                  |
+|                                                           |
+| Description: Synchronizes this controller's frames with   |
+|              the other members of a barrier, or stops     |
+|              doing so when given nullptr. The writer      |
+|              thread switches over on its next pass.       |
+|                                                           |
+| Parameters:                                               |
+|   barrier - The barrier to join                           |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetFrameBarrier(std::shared_ptr<AMBXFrameBarrier> barrier)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        
+        frame_barrier   = barrier;
+        barrier_changed = true;
+    }
+    
+    writer_cv.notify_one();
+}
+
+/*---------------------------------------------------------*\
+| Function: GetBarrierStats                                  |
+|                                                           |
+| Description: Reads the skew and release counters of the   |
+|              barrier this controller was given            |
+|                                                           |
+| Returns: The barrier's statistics, all zero without one   |
+\*---------------------------------------------------------*/
+AMBXBarrierStats AMBXController::GetBarrierStats()
+{
+    std::shared_ptr<AMBXFrameBarrier> barrier;
+    
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        
+        barrier = frame_barrier;
+    }
+    
+    if(barrier == nullptr)
+    {
+        AMBXBarrierStats barrier_stats = {};
+        
+        return barrier_stats;
+    }
+    
+    return barrier->GetStats();
+}
+
+/*---------------------------------------------------------*\
+| Function: JoinFrameBarrier                                 |
+|                                                           |
+| Description: Makes the writer thread a member of the      |
+|              given barrier, leaving the one it was in.    |
+|              Only called on the writer thread.            |
+|                                                           |
+| Parameters:                                               |
+|   barrier - The barrier to be a member of, or nullptr     |
+|             for none                                     |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::JoinFrameBarrier(std::shared_ptr<AMBXFrameBarrier> barrier)
+{
+    if(barrier == joined_barrier)
+    {
+        return;
+    }
+    
+    if(joined_barrier != nullptr)
+    {
+        joined_barrier->Leave();
+    }
+    
+    if(barrier != nullptr)
+    {
+        barrier->Join();
+    }
+    
+    joined_barrier = barrier;
+}
+
+/*---------------------------------------------------------*\
+| Function: SetMinimumPacketGap                              |
+|                                                           |
+| Description: Sets the shortest gap the pacing may shrink  |
+|              to. The gap never goes below the OUT         |
+|              endpoint's polling interval either way.      |
+|                                                           |
+| Parameters:                                               |
+|   gap_us - Minimum gap between packets in microseconds    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetMinimumPacketGap(unsigned int gap_us)
+{
+    configured_min_gap_us.store(std::min(gap_us, (unsigned int)AMBX_PACING_MAX_GAP), std::memory_order_relaxed);
+    UpdateMinimumPacketGap();
+}
+
+void AMBXController::UpdateMinimumPacketGap()
+{
+    min_packet_gap_us.store(std::max(configured_min_gap_us.load(std::memory_order_relaxed),
+                                     endpoint_interval_us.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+}
+
+unsigned int AMBXController::GetMinimumPacketGap()
+{
+    return min_packet_gap_us.load(std::memory_order_relaxed);
+}
+
+unsigned int AMBXController::GetPacketGap()
+{
+    return packet_gap_us.load(std::memory_order_relaxed);
+}
+
+unsigned int AMBXController::GetPacketRate()
+{
+    return stats.GetPacketRate();
+}
+
+/*---------------------------------------------------------*\
+| Function: SetPacingSpin                                    |
+|                                                           |
+| Description: Sets how long before each packet deadline    |
+|              the writer busy-waits instead of sleeping    |
+|                                                           |
+| Parameters:                                               |
+|   spin_us - Busy-wait time in microseconds, 0 to always   |
+|             sleep                                         |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetPacingSpin(unsigned int spin_us)
+{
+    packet_scheduler.SetSpin(spin_us);
+}
+
+AMBXSchedulerStats AMBXController::GetPacingJitter()
+{
+    return packet_scheduler.GetStats();
+}
+
+/*---------------------------------------------------------*\
+| Function: WaitForPacketGap                                 |
+|                                                           |
+| Description: Holds the sender until the current packet    |
+|              gap has elapsed since the previous submit.   |
+|              The wait is on an absolute deadline so       |
+|              oversleeping does not add up across packets. |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::WaitForPacketGap()
+{
+    AMBX_TRACE_SCOPE("WaitForPacketGap");
+    
+    std::chrono::steady_clock::time_point slot = std::chrono::steady_clock::now();
+    
+    // Back to back packets are spaced from their deadline, not from when the sleep ended
+    if(slot < next_packet_time)
+    {
+        packet_scheduler.SleepUntil(next_packet_time);
+        slot = next_packet_time;
+    }
+    
+    unsigned int gap = std::max(packet_gap_us.load(std::memory_order_relaxed),
+                                min_packet_gap_us.load(std::memory_order_relaxed));
+    
+    next_packet_time = slot + std::chrono::microseconds(gap);
+}
+
+/*---------------------------------------------------------*\
+| Function: UpdatePacing                                     |
+|                                                           |
+| Description: Adjusts the packet gap from the outcome of a |
+|              completed transfer                           |
+|                                                           |
+| Parameters:                                               |
+|   status  - libusb status of the completed transfer       |
+|   latency - Time from submit to completion                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::UpdatePacing(libusb_transfer_status status, std::chrono::steady_clock::duration latency)
+{
+    unsigned int gap     = packet_gap_us.load(std::memory_order_relaxed);
+    unsigned int min_gap = min_packet_gap_us.load(std::memory_order_relaxed);
+    
+    switch(status)
+    {
+        case LIBUSB_TRANSFER_COMPLETED:
+            // Completions slower than twice the gap mean the device is queueing
+            if(std::chrono::duration_cast<std::chrono::microseconds>(latency).count() > 2 * (long long)gap)
+            {
+                gap += std::max(gap / 8, (unsigned int)AMBX_PACING_STEP);
+            }
+            else
+            {
+                gap -= gap / 16;
+            }
+            break;
+        
+        case LIBUSB_TRANSFER_CANCELLED:
+            return;
+        
+        default:
+            // Timeouts, stalls and other errors back off hard
+            gap = std::max(gap * 2, (unsigned int)AMBX_PACING_STEP);
+            break;
+    }
+    
+    gap = std::max(gap, min_gap);
+    gap = std::min(gap, (unsigned int)AMBX_PACING_MAX_GAP);
+    
+    packet_gap_us.store(gap, std::memory_order_relaxed);
+}
+
+/*---------------------------------------------------------*\
+| Function: UpdateShadow                                     |
+|                                                           |
+| Description: Records the color just sent to a light       |
+|                                                           |
+| Parameters:                                               |
+|   light - The ID of the light, or AMBX_LIGHT_ALL          |
+|   color - RGB color value sent                            |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::UpdateShadow(unsigned int light, RGBColor color)
+{
+    if(light == AMBX_LIGHT_ALL)
+    {
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            shadow_colors[slot].store(color, std::memory_order_relaxed);
+        }
+        
+        shadow_valid.store((1 << AMBX_LIGHT_COUNT) - 1, std::memory_order_release);
+        return;
+    }
+    
+    int slot = GetAMBXLightSlot(light);
+    
+    if(slot >= 0)
+    {
+        shadow_colors[slot].store(color, std::memory_order_relaxed);
+        shadow_valid.fetch_or(1 << slot, std::memory_order_release);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: InvalidateShadow                                 |
+|                                                           |
+| Description: Forces a light to be sent on the next frame  |
+|                                                           |
+| Parameters:                                               |
+|   light - The ID of the light, or AMBX_LIGHT_ALL          |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::InvalidateShadow(unsigned int light)
+{
+    if(light == AMBX_LIGHT_ALL)
+    {
+        shadow_valid.store(0, std::memory_order_release);
+        return;
+    }
+    
+    int slot = GetAMBXLightSlot(light);
+    
+    if(slot >= 0)
+    {
+        shadow_valid.fetch_and(~(1u << slot), std::memory_order_release);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: TransferComplete                                 |
+|                                                           |
+| Description: Handles completion of a packet written by    |
+|              the transport, on the transport's thread     |
+|                                                           |
+| Parameters:                                               |
+|   packet  - Byte array containing the packet data         |
+|   size    - Size of the packet in bytes                   |
+|   status  - libusb status of the transfer                 |
+|   latency - Time from submit to completion                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::TransferComplete(const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency)
+{
+    if(AMBXTrace::IsEnabled())
+    {
+        long long latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+        
+        AMBXTrace::Complete("Transfer", AMBXTrace::Now() - latency_ns, latency_ns, "status", status);
+    }
+    
+    stats.PacketCompleted(size, status, latency);
+    UpdatePacing(status, latency);
+    
+    bool probe = false;
+    
+    // Packets complete in submit order, so this tells when a released frame hit the wire
+    {
+        std::lock_guard<std::mutex> lock(wire_mutex);
+        
+        packets_completed++;
+        last_completion_time = std::chrono::steady_clock::now();
+        
+        if(wire_barrier != nullptr && packets_completed == wire_packet)
+        {
+            wire_barrier->ReportWireTime(wire_generation, last_completion_time);
+            wire_barrier = nullptr;
+        }
+        
+        if(packets_completed == probe_packet)
+        {
+            probe        = true;
+            probe_done   = true;
+            probe_status = status;
+        }
+    }
+    
+    if(probe)
+    {
+        probe_cv.notify_all();
+    }
+    
+    if(status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        // A rejected probe is an answer, not an error
+        if(status != LIBUSB_TRANSFER_CANCELLED && status != LIBUSB_TRANSFER_NO_DEVICE && connected && !probe)
+        {
+            AMBX_LOG_ERROR_LIMITED(transfer_log_limiter, status, "Failed to send interrupt transfer to amBX device at %s: status %d", location.c_str(), status);
+        }
+        
+        PacketFailed(packet, size);
+    }
+}
+
+void AMBXController::TransferCallback(void* callback_arg, const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency)
+{
+    static_cast<AMBXController*>(callback_arg)->TransferComplete(packet, size, status, latency);
+}
+
+/*---------------------------------------------------------*\
+| Function: ConnectionChanged                                |
+|                                                           |
+| Description: Parks the controller when its device is      |
+|              unplugged. When the device comes back, every |
+|              light and any running sequence is sent again |
+|              so it picks up where it left off.            |
+|                                                           |
+| Parameters:                                               |
+|   now_connected - Whether the device is present           |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::ConnectionChanged(bool now_connected)
+{
+    if(!now_connected)
+    {
+        connected = false;
+        
+        // Wake the writer so it leaves any frame barrier
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+        }
+        
+        writer_cv.notify_one();
+        return;
+    }
+    
+    InvalidateShadow(AMBX_LIGHT_ALL);
+    connected = true;
+    
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        
+        // The mailbox still holds the last frame, resend all of it
+        mailbox_pending.fetch_or((1 << AMBX_LIGHT_COUNT) - 1, std::memory_order_relaxed);
+        sequence_changed = true;
+        
+        // The transport read the endpoints again when it attached the device
+        endpoint_changed = true;
+    }
+    
+    writer_cv.notify_one();
+}
+
+void AMBXController::ConnectionCallback(void* callback_arg, bool now_connected)
+{
+    static_cast<AMBXController*>(callback_arg)->ConnectionChanged(now_connected);
+}
+
+/*---------------------------------------------------------*\
+| Function: FlushSuppressedErrors                            |
+|                                                           |
+| Description: Logs how many submit and transfer errors     |
+|              were suppressed for each error whose repeat  |
+|              interval is over, so the count is not held   |
+|              back until the same error happens again.     |
+|              Called from the writer thread.               |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::FlushSuppressedErrors()
+{
+    int          key;
+    unsigned int suppressed;
+    
+    while(submit_log_limiter.TakeSuppressed(key, suppressed))
+    {
+        AMBX_LOG_ERROR("%u more failures to submit interrupt transfers to amBX device at %s suppressed: %s", suppressed, location.c_str(), libusb_error_name(key));
+    }
+    
+    while(transfer_log_limiter.TakeSuppressed(key, suppressed))
+    {
+        AMBX_LOG_ERROR("%u more failed interrupt transfers to amBX device at %s suppressed: status %d", suppressed, location.c_str(), key);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: PacketFailed                                     |
+|                                                           |
+| Description: Called when a packet was not delivered.      |
+|              Every light it set a color on is sent again  |
+|              with the next frame.                         |
+|                                                           |
+| Parameters:                                               |
+|   packet - Byte array containing the packet data          |
+|   size   - Size of the packet in bytes                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::PacketFailed(const unsigned char* packet, unsigned int size)
+{
+    // A packet may carry several SET_COLOR commands back to back
+    for(unsigned int offset = 0; offset + AMBX_COLOR_PACKET_SIZE <= size; offset += AMBX_COLOR_PACKET_SIZE)
+    {
+        if(packet[offset] != AMBX_PACKET_HEADER || packet[offset + 2] != AMBX_SET_COLOR)
+        {
+            break;
+        }
+        
+        InvalidateShadow(packet[offset + 1]);
+        stats.LightInvalidated();
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: SendPacket                                       |
+|                                                           |
+| Description: Queues a packet to the AMBX device as an     |
+|              asynchronous interrupt transfer. Returns as  |
+|              soon as the transfer has been submitted,     |
+|              which is held back by the pacing gap.        |
+|                                                           |  
+| Parameters:                                               |
+|   packet - Byte array containing the packet data          |
+|   size   - Size of the packet in bytes                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SendPacket(unsigned char* packet, unsigned int size)
+{
+    AMBX_TRACE_SCOPE("SendPacket", "light", packet[1]);
+    
+    if(!initialized)
+    {
+        AMBX_LOG_ERROR("Device not initialized for AMBX");
+        return;
+    }
+    
+    // Drop packets while the device is unplugged or the writer is being torn down
+    if(!connected || writer_abort)
+    {
+        stats.PacketDropped();
+        PacketFailed(packet, size);
+        return;
+    }
+    
+    // Keep packets apart by the current pacing gap
+    WaitForPacketGap();
+    
+    std::chrono::steady_clock::time_point submit_time = std::chrono::steady_clock::now();
+    
+    int result = transport->Write(packet, size);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        stats.SubmitFailed(result);
+        
+        if(result != LIBUSB_ERROR_NO_DEVICE)
+        {
+            AMBX_LOG_ERROR_LIMITED(submit_log_limiter, result, "Failed to submit interrupt transfer to amBX device at %s: %s", location.c_str(), libusb_error_name(result));
+        }
+        else if(connected.exchange(false))
+        {
+            AMBX_LOG_WARNING("amBX device at %s is gone, waiting for it to be plugged back in", location.c_str());
+        }
+        
+        PacketFailed(packet, size);
+        return;
+    }
+    
+    stats.PacketSubmitted(size, submit_time);
+}
+
+/*---------------------------------------------------------*\
+| Function: SendBlackout                                     |
+|                                                           |
+| Description: Queues one broadcast packet turning every    |
+|              light off, without waiting for it. Pacing is |
+|              held to the minimum gap so shutdown does not |
+|              wait out a backed-off gap.                   |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SendBlackout()
+{
+    unsigned char color_buf[6] = { AMBX_PACKET_HEADER, AMBX_LIGHT_ALL, AMBX_SET_COLOR, 0, 0, 0 };
+    
+    std::chrono::steady_clock::time_point earliest = std::chrono::steady_clock::now() + std::chrono::microseconds(min_packet_gap_us.load());
+    
+    packet_scheduler.SleepUntil(std::min(next_packet_time, earliest));
+    
+    std::chrono::steady_clock::time_point submit_time = std::chrono::steady_clock::now();
+    
+    int result = transport->Write(color_buf, sizeof(color_buf));
+    
+    if(result == LIBUSB_SUCCESS)
+    {
+        stats.PacketSubmitted(sizeof(color_buf), submit_time);
+    }
+    else
+    {
+        stats.SubmitFailed(result);
+        AMBX_LOG_DEBUG("AMBX blackout at %s not sent: %s", location.c_str(), libusb_error_name(result));
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: SetSingleColor                                   |
+|                                                           |
+| Description: Sets a single light to the specified RGB     |
+|              color value. The color is published to the   |
+|              mailbox and sent by the writer thread.       |
+|                                                           |
+| Parameters:                                               |
+|   light - The ID of the light to set                      |
+|   red   - Red component (0-255)                           |
+|   green - Green component (0-255)                         |
+|   blue  - Blue component (0-255)                          |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetSingleColor(unsigned int light, unsigned char red, unsigned char green, unsigned char blue)
+{
+    if(!IsAMBXLight(light))
+    {
+        AMBX_LOG_ERROR("Invalid AMBX light ID: 0x%02X", light);
+        return;
+    }
+    
+    PublishMailbox(StoreMailboxColor(static_cast<AMBXLight>(light), ToRGBColor(red, green, blue)));
+}
+
+/*---------------------------------------------------------*\
+| Function: BuildColorPacket                                 |
+|                                                           |
+| Description: Fills in a SET_COLOR packet                  |
+|                                                           |
+| Parameters:                                               |
+|   packet - Buffer of AMBX_COLOR_PACKET_SIZE bytes         |
+|   light  - The light to set                               |
+|   color  - RGB color value                                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::BuildColorPacket(unsigned char* packet, AMBXLight light, RGBColor color)
+{
+    packet[0] = AMBX_PACKET_HEADER;
+    packet[1] = static_cast<unsigned char>(light);
+    packet[2] = AMBX_SET_COLOR;
+    packet[3] = RGBGetRValue(color);
+    packet[4] = RGBGetGValue(color);
+    packet[5] = RGBGetBValue(color);
+}
+
+/*---------------------------------------------------------*\
+| Function: BuildFrameBatch                                  |
+|                                                           |
+| Description: Builds the SET_COLOR packets of a frame in   |
+|              one pass, in slot order                      |
+|                                                           |
+| Parameters:                                               |
+|   batch  - The batch to fill                              |
+|   colors - Color of each slot, read for slots in mask     |
+|   mask   - Slots to build packets for                     |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::BuildFrameBatch(AMBXFrameBatch& batch, const RGBColor* colors, unsigned int mask)
+{
+    unsigned int count = 0;
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        if(mask & (1 << slot))
+        {
+            unsigned char* packet = batch.packets[count++];
+            
+            packet[0] = AMBX_PACKET_HEADER;
+            packet[1] = static_cast<unsigned char>(ambx_light_order[slot]);
+            packet[2] = AMBX_SET_COLOR;
+            packet[3] = RGBGetRValue(colors[slot]);
+            packet[4] = RGBGetGValue(colors[slot]);
+            packet[5] = RGBGetBValue(colors[slot]);
+        }
+    }
+    
+    batch.count = count;
+}
+
+/*---------------------------------------------------------*\
+| Function: SetAllColors                                     |
+|                                                           |
+| Description: Sets all lights to the same color, sent by   |
+|              the writer thread as one broadcast packet    |
+|                                                           |
+| Parameters:                                               |
+|   color - RGB color value to set for all lights           |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetAllColors(RGBColor color)
+{
+    PublishMailbox(StoreMailboxColor(AMBXLight::All, color));
+}
+
+/*---------------------------------------------------------*\
+| Function: SetLEDColor                                      |
+|                                                           |
+| Description: Sets a specific LED to a color, sent by the  |
+|              writer thread                                |
+|                                                           |
+| Parameters:                                               |
+|   led   - The ID of the LED to set                        |
+|   color - RGB color value                                 |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetLEDColor(unsigned int led, RGBColor color)
+{
+    if(!initialized)
+    {
+        AMBX_LOG_ERROR("Cannot set LED color - AMBX device not initialized");
+        return;
+    }
+    
+    if(!IsAMBXLight(led))
+    {
+        AMBX_LOG_ERROR("Invalid AMBX LED ID: 0x%02X", led);
+        return;
+    }
+    
+    PublishMailbox(StoreMailboxColor(static_cast<AMBXLight>(led), color));
+}
+
+/*---------------------------------------------------------*\
+| Function: SetLEDColors                                     |
+|                                                           |
+| Description: Sets multiple LEDs to different colors. The  |
+|              frame is published to the mailbox like       |
+|              QueueLEDColors, and the writer thread skips  |
+|              LEDs already showing their color.            |
+|                                                           |
+| Parameters:                                               |
+|   leds   - Array of LED IDs                               |
+|   colors - Array of RGB color values                      |
+|   count  - Number of LEDs to set                          |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SetLEDColors(unsigned int* leds, RGBColor* colors, unsigned int count)
+{
+    if(!initialized)
+    {
+        AMBX_LOG_ERROR("Cannot set LED colors - AMBX device not initialized");
+        return;
+    }
+    
+    QueueLEDColors(leds, colors, count);
+}
+
+/*---------------------------------------------------------*\
+| Function: SendFrame                                        |
+|                                                           |
+| Description: Sends a frame of already validated slot      |
+|              colors. Lights already showing their color   |
+|              are skipped, and a frame that leaves every   |
+|              light the same color goes out as one         |
+|              broadcast packet. Otherwise the changed      |
+|              lights are packed commands_per_packet to a   |
+|              transfer.                                    |
+|                                                           |
+| Parameters:                                               |
+|   colors  - Color of each slot, read for slots in mask    |
+|   mask    - Slots to set                                  |
+|   updates - Light updates the frame stands for, to count  |
+|             the transfers skipped against sending each    |
+|             of them packed as tightly as the device takes |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SendFrame(const RGBColor* colors, unsigned int mask, unsigned int updates)
+{
+    AMBX_TRACE_SCOPE("SendFrame", "updates", updates);
+    
+    const unsigned int all_lights       = (1 << AMBX_LIGHT_COUNT) - 1;
+    const unsigned int commands         = commands_per_packet.load(std::memory_order_relaxed);
+    const unsigned int update_transfers = (updates + commands - 1) / commands;
+    
+    unsigned int known   = shadow_valid.load(std::memory_order_acquire);
+    unsigned int changed = 0;
+    RGBColor     targets[AMBX_LIGHT_COUNT];
+    
+    // Work out the color each light should end up with and which lights changed
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        RGBColor shadow = shadow_colors[slot].load(std::memory_order_relaxed);
+        
+        if(!(mask & (1 << slot)))
+        {
+            targets[slot] = shadow;
+            continue;
+        }
+        
+        if(!(known & (1 << slot)) || shadow != colors[slot])
+        {
+            changed |= 1 << slot;
+        }
+        
+        targets[slot] = colors[slot];
+    }
+    
+    known |= mask;
+    
+    unsigned int changed_count = (unsigned int)std::bitset<AMBX_LIGHT_COUNT>(changed).count();
+    
+    if(changed == 0)
+    {
+        stats.PacketsSkipped(update_transfers);
+        return;
+    }
+    
+    /*-----------------------------------------------------*\
+    | If more than one light changed and the whole frame is |
+    | a single color, one broadcast packet replaces them    |
+    \*-----------------------------------------------------*/
+    bool uniform = (changed_count > 1) && (known == all_lights);
+    
+    for(unsigned int slot = 1; uniform && slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        uniform = (targets[slot] == targets[0]);
+    }
+    
+    AMBXFrameBatch batch;
+    
+    // Record the colors before sending, a failed transfer invalidates them again
+    if(uniform)
+    {
+        BuildColorPacket(batch.packets[0], AMBXLight::All, targets[0]);
+        batch.count = 1;
+        
+        UpdateShadow(AMBX_LIGHT_ALL, targets[0]);
+    }
+    else
+    {
+        // Otherwise one packet for each light whose color changed
+        BuildFrameBatch(batch, targets, changed);
+        
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            if(changed & (1 << slot))
+            {
+                shadow_colors[slot].store(targets[slot], std::memory_order_relaxed);
+            }
+        }
+        
+        shadow_valid.fetch_or(changed, std::memory_order_release);
+    }
+    
+    // Skipped counts transfers, which hold several commands on a multi-command device
+    stats.PacketsSkipped(update_transfers - (batch.count + commands - 1) / commands);
+    
+    // Submit the packets back to back, SendPacket paces each transfer against the previous one
+    for(unsigned int packet = 0; packet < batch.count; packet += commands)
+    {
+        unsigned int packet_commands = std::min(commands, batch.count - packet);
+        
+        SendPacket(batch.packets[packet], packet_commands * AMBX_COLOR_PACKET_SIZE);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: QueueLEDColor                                    |
+|                                                           |
+| Description: Publishes a new color for one LED to the     |
+|              writer thread without blocking               |
+|                                                           |
+| Parameters:                                               |
+|   led   - The ID of the LED to set                        |
+|   color - RGB color value                                 |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::QueueLEDColor(unsigned int led, RGBColor color)
+{
+    QueueLEDColors(&led, &color, 1);
+}
+
+/*---------------------------------------------------------*\
+| Function: QueueLEDColors                                   |
+|                                                           |
+| Description: Publishes a frame to the latest-wins mailbox.|
+|              Colors not yet picked up by the writer are   |
+|              overwritten, so a slow device never causes   |
+|              frames to back up. This is where IDs from    |
+|              the RGBController are validated, the writer  |
+|              only sees slots.                             |
+|                                                           |
+| Parameters:                                               |
+|   leds   - Array of LED IDs                               |
+|   colors - Array of RGB color values                      |
+|   count  - Number of LEDs to set                          |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::QueueLEDColors(unsigned int* leds, RGBColor* colors, unsigned int count)
 {
-    initialized = false;
-    interface_claimed = false;
-    usb_context = nullptr;
-    dev_handle = nullptr;
+    unsigned int mask = 0;
+    
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(!IsAMBXLight(leds[i]))
+        {
+            AMBX_LOG_ERROR("Invalid AMBX LED ID: 0x%02X", leds[i]);
+            continue;
+        }
+        
+        mask |= StoreMailboxColor(static_cast<AMBXLight>(leds[i]), colors[i]);
+    }
+    
+    PublishMailbox(mask);
+}
+
+/*---------------------------------------------------------*\
+| Function: StoreMailboxColor                                |
+|                                                           |
+| Description: Stores a light's newest color in its mailbox |
+|              slot, or in every slot for the broadcast ID. |
+|              The ID was checked where it entered the      |
+|              driver, so it is not checked again.          |
+|                                                           |
+| Parameters:                                               |
+|   light - The light to set                                |
+|   color - RGB color value                                 |
+|                                                           |
+| Returns: The mailbox bits of the slots stored             |
+\*---------------------------------------------------------*/
+unsigned int AMBXController::StoreMailboxColor(AMBXLight light, RGBColor color)
+{
+    unsigned int slot = ambx_light_lookup.entries[static_cast<unsigned char>(light)].slot;
+    
+    if(slot == AMBX_LIGHT_SLOT_ALL)
+    {
+        for(slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            mailbox_colors[slot].store(color, std::memory_order_release);
+        }
+        
+        return (1 << AMBX_LIGHT_COUNT) - 1;
+    }
     
-    location = "USB amBX: ";
-    location += path;
+    mailbox_colors[slot].store(color, std::memory_order_release);
     
-    // Initialize libusb in this instance
-    int libusb_result = libusb_init(&usb_context);
-    if(libusb_result != LIBUSB_SUCCESS)
+    return 1 << slot;
+}
+
+/*---------------------------------------------------------*\
+| Function: PublishMailbox                                   |
+|                                                           |
+| Description: Flags stored slots for the writer thread,    |
+|              waking it if the mailbox was empty           |
+|                                                           |
+| Parameters:                                               |
+|   mask - Mailbox bits of the slots stored                 |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::PublishMailbox(unsigned int mask)
+{
+    if(mask == 0)
     {
-        LOG_ERROR("Failed to initialize libusb: %s", libusb_error_name(libusb_result));
         return;
     }
     
-    // Get the device list
-    libusb_device** device_list;
-    ssize_t device_count = libusb_get_device_list(usb_context, &device_list);
+    unsigned int previous = mailbox_pending.fetch_or(mask, std::memory_order_release);
     
-    if(device_count < 0)
+    // Only the first publish after the writer drained the mailbox needs to wake it
+    if(previous == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+        }
+        
+        writer_cv.notify_one();
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: StartWriterThread                                |
+|                                                           |
+| Description: Starts the thread that drains the mailbox    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::StartWriterThread()
+{
+    writer_thread_done = false;
+    writer_thread_run  = true;
+    writer_thread     = std::thread(&AMBXController::WriterThreadFunction, this);
+}
+
+/*---------------------------------------------------------*\
+| Function: StopWriterThread                                 |
+|                                                           |
+| Description: Stops the writer thread and waits for the    |
+|              frame it is currently sending. If that takes |
+|              longer than the stop timeout, the rest of    |
+|              its packets are dropped so the join cannot   |
+|              hang on a stalled device.                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::StopWriterThread()
+{
+    if(!writer_thread.joinable())
     {
-        LOG_ERROR("Failed to get USB device list: %s", libusb_error_name(static_cast<int>(device_count)));
         return;
     }
     
-    // Find our device in the list
-    for(ssize_t i = 0; i < device_count; i++)
     {
-        libusb_device* device = device_list[i];
-        struct libusb_device_descriptor desc;
+        std::unique_lock<std::mutex> lock(writer_mutex);
         
-        if(libusb_get_device_descriptor(device, &desc) != LIBUSB_SUCCESS)
+        writer_thread_run = false;
+        writer_cv.notify_all();
+        
+        if(!writer_cv.wait_for(lock, std::chrono::milliseconds(AMBX_WRITER_STOP_TIMEOUT), [this]
         {
-            continue;
+            return writer_thread_done;
+        }))
+        {
+            AMBX_LOG_WARNING("amBX writer thread did not stop within %d ms, dropping its remaining packets", AMBX_WRITER_STOP_TIMEOUT);
+            writer_abort = true;
+        }
+    }
+    
+    writer_thread.join();
+    
+    // Queued commands are dropped along with any pending frame, the writer is gone so this thread may pop
+    ambx_command dropped;
+    
+    while(command_ring.Pop(dropped))
+    {
+    }
+    
+    command_count = 0;
+    writer_abort = false;
+}
+
+/*---------------------------------------------------------*\
+| Function: WriterThreadFunction                             |
+|                                                           |
+| Description: Sends the newest published color of every    |
+|              light flagged in the mailbox, and every      |
+|              light once per full refresh interval         |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::WriterThreadFunction()
+{
+    const std::chrono::milliseconds       refresh_interval(AMBX_FULL_REFRESH_INTERVAL);
+    const std::chrono::milliseconds       idle_timeout(AMBX_BARRIER_IDLE_TIMEOUT);
+    const std::chrono::milliseconds       log_flush_interval(AMBX_LOG_REPEAT_INTERVAL);
+    std::chrono::steady_clock::time_point next_refresh = std::chrono::steady_clock::now() + refresh_interval;
+    std::chrono::steady_clock::time_point next_log_flush = std::chrono::steady_clock::now() + log_flush_interval;
+    std::chrono::steady_clock::time_point next_sequence;
+    std::chrono::steady_clock::time_point last_frame_time;
+    
+    bool         running_sequence = false;
+    RGBColor     running_colors[AMBX_SEQUENCE_STEPS];
+    unsigned int running_step_ms  = 0;
+    
+    ambx_command                      command;
+    std::shared_ptr<AMBXFrameBarrier> barrier;
+    
+    char thread_name[AMBX_TRACE_THREAD_NAME];
+    snprintf(thread_name, sizeof(thread_name), "amBX writer %s", location.c_str());
+    AMBXTrace::SetThreadName(thread_name);
+    
+    // A lazily opened device is opened here, off the detection thread
+    bool ready = OpenWithRetry();
+    
+    while(ready && writer_thread_run)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        
+        // Report errors held back by the log limiters once their interval is over
+        if(now >= next_log_flush)
+        {
+            FlushSuppressedErrors();
+            next_log_flush = now + log_flush_interval;
         }
         
-        if(desc.idVendor == AMBX_VID && desc.idProduct == AMBX_PID)
+        // Write out the trace before the thread buffers fill up
+        AMBXTrace::FlushIfDue();
+        
+        bool reattached = false;
+        
+        // Pick up a sequence started or stopped since the last pass
         {
-            // Get bus and address for identifying multiple devices
-            uint8_t bus = libusb_get_bus_number(device);
-            uint8_t address = libusb_get_device_address(device);
+            std::lock_guard<std::mutex> lock(writer_mutex);
             
-            char device_id[32];
-            sprintf(device_id, "Bus %d Addr %d", bus, address);
-            location = std::string("USB amBX: ") + device_id;
+            barrier = frame_barrier;
             
-            // Try to open this device
-            int result = libusb_open(device, &dev_handle);
+            reattached       = endpoint_changed;
+            endpoint_changed = false;
             
-            if(result != LIBUSB_SUCCESS)
+            // A new barrier is joined right away rather than with the next frame
+            if(barrier_changed)
             {
-                LOG_WARNING("Failed to open AMBX device: %s", libusb_error_name(result));
-                continue;
+                barrier_changed = false;
+                last_frame_time = now;
             }
             
-            // Try to detach the kernel driver if attached
-            if(libusb_kernel_driver_active(dev_handle, 0))
+            if(sequence_changed)
             {
-                libusb_detach_kernel_driver(dev_handle, 0);
+                running_sequence = sequence_active;
+                running_step_ms  = sequence_step_ms;
+                memcpy(running_colors, sequence_colors, sizeof(running_colors));
+                
+                sequence_changed = false;
+                next_sequence    = now;
             }
+        }
+        
+        /*-------------------------------------------------*\
+        | A replugged device may advertise another packet   |
+        | size or polling interval, so the pacing floor and |
+        | commands per transfer are worked out again before |
+        | anything is resent. It comes back dark, so the    |
+        | probe shows nothing.                              |
+        \*-------------------------------------------------*/
+        if(reattached)
+        {
+            ReadEndpoint();
+            commands_per_packet = ProbeMultiCommand();
+        }
+        
+        /*-------------------------------------------------*\
+        | Only a device about to send direct frames may     |
+        | hold the others up. While a sequence plays, the   |
+        | device is unplugged or no frame has come for a    |
+        | while, the writer stays out of the barrier.       |
+        \*-------------------------------------------------*/
+        bool frame_due = (mailbox_pending.load(std::memory_order_relaxed) != 0) || ((now - last_frame_time) < idle_timeout);
+        
+        JoinFrameBarrier((!running_sequence && connected && frame_due) ? barrier : nullptr);
+        
+        /*-------------------------------------------------*\
+        | Send queued commands in the order they were       |
+        | queued, at most one ring's worth per pass so a    |
+        | flood of commands cannot starve frames            |
+        \*-------------------------------------------------*/
+        unsigned int sent_commands = 0;
+        
+        while(sent_commands < AMBX_COMMAND_QUEUE_DEPTH && command_ring.Pop(command))
+        {
+            SendColorSequence(command.light, command.step_ms, command.colors, command.count);
+            sent_commands++;
+        }
+        
+        if(sent_commands > 0)
+        {
+            command_count.fetch_sub(sent_commands, std::memory_order_relaxed);
+        }
+        
+        if(running_sequence)
+        {
+            // Upload the sequence again each time the device finishes playing it
+            if(now >= next_sequence)
+            {
+                SendColorSequence(AMBX_LIGHT_ALL, running_step_ms, running_colors, AMBX_SEQUENCE_STEPS);
+                next_sequence = now + std::chrono::milliseconds(running_step_ms * AMBX_SEQUENCE_STEPS);
+            }
+        }
+        else if(now >= next_refresh)
+        {
+            // Periodically resend every light in case the device lost its state
+            InvalidateShadow(AMBX_LIGHT_ALL);
+            mailbox_pending.fetch_or((1 << AMBX_LIGHT_COUNT) - 1, std::memory_order_relaxed);
+            next_refresh = now + refresh_interval;
+        }
+        
+        unsigned long long generation = 0;
+        
+        // Hold the staged frame until the other devices have one too
+        if(joined_barrier != nullptr && mailbox_pending.load(std::memory_order_relaxed) != 0)
+        {
+            generation = joined_barrier->Arrive();
+        }
+        
+        unsigned int pending = mailbox_pending.exchange(0, std::memory_order_acquire);
+        
+        if(pending == 0)
+        {
+            std::chrono::steady_clock::time_point deadline = running_sequence ? next_sequence : next_refresh;
             
-            // Set auto-detach for Windows compatibility
-            libusb_set_auto_detach_kernel_driver(dev_handle, 1);
-            
-            // Claim the interface - IMPORTANT: keep it claimed until destruction
-            result = libusb_claim_interface(dev_handle, 0);
+            // Wake up to leave the barrier once idle
+            if(joined_barrier != nullptr)
+            {
+                deadline = std::min(deadline, last_frame_time + idle_timeout);
+            }
             
-            if(result != LIBUSB_SUCCESS)
+            // Wake up to report suppressed errors even if nothing else happens
+            if(submit_log_limiter.HasSuppressed() || transfer_log_limiter.HasSuppressed())
             {
-                LOG_ERROR("Failed to claim interface: %s", libusb_error_name(result));
-                libusb_close(dev_handle);
-                dev_handle = nullptr;
-                continue;
+                deadline = std::min(deadline, next_log_flush);
             }
             
-            interface_claimed = true;
+            std::unique_lock<std::mutex> lock(writer_mutex);
+            
+            writer_cv.wait_until(lock, deadline, [this]
+            {
+                return mailbox_pending.load(std::memory_order_relaxed) != 0 || !command_ring.Empty() || sequence_changed || barrier_changed || (joined_barrier != nullptr && !connected) || !writer_thread_run;
+            });
             
-            // Get string descriptor for serial number if available
-            if(desc.iSerialNumber != 0)
+            continue;
+        }
+        
+        // The mailbox only holds slots validated when the frame was queued
+        RGBColor     colors[AMBX_LIGHT_COUNT];
+        unsigned int count = 0;
+        
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            if(pending & (1 << slot))
             {
-                unsigned char serial_str[256];
-                int serial_result = libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, 
-                                                                       serial_str, sizeof(serial_str));
-                if(serial_result > 0)
-                {
-                    serial = std::string(reinterpret_cast<char*>(serial_str), serial_result);
-                }
+                colors[slot] = mailbox_colors[slot].load(std::memory_order_acquire);
+                count++;
             }
+        }
+        
+        unsigned long long packets_before = stats.GetPacketsSubmitted();
+        
+        SendFrame(colors, pending, count);
+        
+        last_frame_time = std::chrono::steady_clock::now();
+        stats.FrameSent(last_frame_time);
+        
+        unsigned long long packets_after = stats.GetPacketsSubmitted();
+        
+        if(joined_barrier != nullptr && packets_after != packets_before)
+        {
+            std::lock_guard<std::mutex> lock(wire_mutex);
             
-            // Successfully opened and claimed the device
-            initialized = true;
-            break;
+            if(packets_completed >= packets_after)
+            {
+                // The frame finished before the writer got here
+                joined_barrier->ReportWireTime(generation, last_completion_time);
+            }
+            else
+            {
+                wire_barrier    = joined_barrier;
+                wire_generation = generation;
+                wire_packet     = packets_after;
+            }
         }
     }
     
-    libusb_free_device_list(device_list, 1);
+    // The other devices must not wait for a writer that is gone
+    JoinFrameBarrier(nullptr);
     
-    if(!initialized)
     {
-        LOG_ERROR("Failed to initialize AMBX device - device not found or couldn't be accessed");
-        LOG_ERROR("Check USB connections and permissions");
-        return;
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_thread_done = true;
     }
     
-    // Turn off all lights initially
-    SetAllColors(ToRGBColor(0, 0, 0));
+    writer_cv.notify_all();
 }
 
-AMBXController::~AMBXController()
+/*---------------------------------------------------------*\
+| Function: SendColorSequence                                |
+|                                                           |
+| Description: Uploads a timed color sequence to a light.   |
+|              The device fades through the steps itself,   |
+|              spending step_ms on each one. Only called on |
+|              the writer thread.                           |
+|                                                           |
+| Parameters:                                               |
+|   light   - The ID of the light, or AMBX_LIGHT_ALL        |
+|   step_ms - Time spent on each step in milliseconds       |
+|   colors  - Array of up to AMBX_SEQUENCE_STEPS colors,    |
+|             shorter sequences hold their last color       |
+|   count   - Number of colors in the array                 |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXController::SendColorSequence(unsigned int light, unsigned int step_ms, const RGBColor* colors, unsigned int count)
 {
-    // Turn off all lights before closing
-    if(initialized)
+    if(!IsAMBXLight(light))
     {
-        try
-        {
-            SetAllColors(ToRGBColor(0, 0, 0));
-        }
-        catch(...) {}
+        AMBX_LOG_ERROR("Invalid AMBX light ID: 0x%02X", light);
+        return;
     }
     
-    if(dev_handle != nullptr)
+    if(count == 0)
     {
-        // Release the interface if claimed
-        if(interface_claimed)
-        {
-            libusb_release_interface(dev_handle, 0);
-            interface_claimed = false;
-        }
-        
-        // Close the device
-        libusb_close(dev_handle);
-        dev_handle = nullptr;
+        return;
     }
     
-    if(usb_context != nullptr)
+    step_ms = std::min(step_ms, 0xFFFFu);
+    
+    unsigned char sequence_buf[AMBX_SEQUENCE_PACKET_SIZE];
+    
+    // Set up message packet
+    sequence_buf[0] = AMBX_PACKET_HEADER;
+    sequence_buf[1] = light;
+    sequence_buf[2] = AMBX_SET_COLOR_SEQUENCE;
+    sequence_buf[3] = (step_ms >> 8) & 0xFF;
+    sequence_buf[4] = step_ms & 0xFF;
+    
+    for(unsigned int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
     {
-        libusb_exit(usb_context);
-        usb_context = nullptr;
+        RGBColor color = colors[std::min(step, count - 1)];
+        
+        sequence_buf[5 + (step * 3)]     = RGBGetRValue(color);
+        sequence_buf[5 + (step * 3) + 1] = RGBGetGValue(color);
+        sequence_buf[5 + (step * 3) + 2] = RGBGetBValue(color);
     }
+    
+    // The light's color is in motion, so the next direct frame must be sent
+    InvalidateShadow(light);
+    
+    SendPacket(sequence_buf, AMBX_SEQUENCE_PACKET_SIZE);
 }
 
-std::string AMBXController::GetDeviceLocation()
-{
-    return location;
-}
-
-std::string AMBXController::GetSerialString()
-{
-    return serial;
-}
-
-bool AMBXController::IsInitialized()
-{
-    return initialized;
-}
-
-
-
-
-
 /*---------------------------------------------------------*\
-| Function: SendPacket                                       |
+| Function: SetColorSequence                                 |
+|                                                           |
+| Description: Has the writer thread upload a timed color   |
+|              sequence to a light, see QueueColorSequence  |
 |                                                           |
-| Description: Sends a packet to the AMBX device            |
-|                                                           |  
 | Parameters:                                               |
-|   packet - Byte array containing the packet data          |
-|   size   - Size of the packet in bytes                    |
+|   light   - The ID of the light, or AMBX_LIGHT_ALL        |
+|   step_ms - Time spent on each step in milliseconds       |
+|   colors  - Array of up to AMBX_SEQUENCE_STEPS colors,    |
+|             shorter sequences hold their last color       |
+|   count   - Number of colors in the array                 |
 |                                                           |
 | Returns: None                                             |
 \*---------------------------------------------------------*/
-void AMBXController::SendPacket(unsigned char* packet, unsigned int size)
+void AMBXController::SetColorSequence(unsigned int light, unsigned int step_ms, RGBColor* colors, unsigned int count)
 {
-    if(!initialized || dev_handle == nullptr)
+    if(!initialized)
     {
-        LOG_ERROR("Device not initialized for AMBX");
+        AMBX_LOG_ERROR("Cannot set color sequence - AMBX device not initialized");
         return;
     }
     
-    if(!interface_claimed)
+    if(!IsAMBXLight(light))
     {
-        LOG_ERROR("USB interface not claimed for AMBX");
+        AMBX_LOG_ERROR("Invalid AMBX light ID: 0x%02X", light);
         return;
     }
     
-    int actual_length = 0;
-    int result = libusb_interrupt_transfer(dev_handle, AMBX_ENDPOINT_OUT, packet, size, &actual_length, 100);
-    
-    if(result != LIBUSB_SUCCESS)
+    if(count > 0 && !QueueColorSequence(light, step_ms, colors, count))
     {
-        LOG_ERROR("Failed to send interrupt transfer: %s", libusb_error_name(result));
+        AMBX_LOG_WARNING("amBX command queue at %s is full, color sequence dropped", location.c_str());
     }
 }
 
 /*---------------------------------------------------------*\
-| Function: SetSingleColor                                   |
+| Function: FadeToColor                                      |
 |                                                           |
-| Description: Sets a single light to the specified RGB     |
-|              color value                                  |
+| Description: Has the writer thread fade a light between   |
+|              two colors with a single sequence packet     |
 |                                                           |
 | Parameters:                                               |
-|   light - The ID of the light to set                      |
-|   red   - Red component (0-255)                           |
-|   green - Green component (0-255)                         |
-|   blue  - Blue component (0-255)                          |
+|   light       - The ID of the light, or AMBX_LIGHT_ALL    |
+|   from        - Starting color                            |
+|   to          - Final color                               |
+|   duration_ms - Length of the fade in milliseconds        |
 |                                                           |
 | Returns: None                                             |
 \*---------------------------------------------------------*/
-void AMBXController::SetSingleColor(unsigned int light, unsigned char red, unsigned char green, unsigned char blue)
+void AMBXController::FadeToColor(unsigned int light, RGBColor from, RGBColor to, unsigned int duration_ms)
+{
+    RGBColor steps[AMBX_SEQUENCE_STEPS];
+    
+    BuildFade(from, to, steps);
+    
+    SetColorSequence(light, duration_ms / AMBX_SEQUENCE_STEPS, steps, AMBX_SEQUENCE_STEPS);
+}
+
+/*---------------------------------------------------------*\
+| Function: QueueColorSequence                               |
+|                                                           |
+| Description: Queues a color sequence upload to the writer |
+|              thread and returns without waiting for the   |
+|              device                                       |
+|                                                           |
+| Parameters:                                               |
+|   light   - The ID of the light, or AMBX_LIGHT_ALL        |
+|   step_ms - Time spent on each step in milliseconds       |
+|   colors  - Array of up to AMBX_SEQUENCE_STEPS colors     |
+|   count   - Number of colors in the array                 |
+|                                                           |
+| Returns: false if the command queue was full              |
+\*---------------------------------------------------------*/
+bool AMBXController::QueueColorSequence(unsigned int light, unsigned int step_ms, RGBColor* colors, unsigned int count)
 {
-    // Validate light ID
-    if(light != AMBX_LIGHT_LEFT && 
-       light != AMBX_LIGHT_RIGHT && 
-       light != AMBX_LIGHT_WALL_LEFT && 
-       light != AMBX_LIGHT_WALL_CENTER && 
-       light != AMBX_LIGHT_WALL_RIGHT && 
-       light != AMBX_LIGHT_ALL)
+    if(count == 0)
     {
-        LOG_ERROR("Invalid AMBX light ID: 0x%02X", light);
-        return;
+        return false;
     }
     
-    unsigned char color_buf[6];
+    ambx_command command;
     
-    // Set up message packet
-    color_buf[0] = AMBX_PACKET_HEADER;
-    color_buf[1] = light;
-    color_buf[2] = AMBX_SET_COLOR;
-    color_buf[3] = red;
-    color_buf[4] = green;
-    color_buf[5] = blue;
-
-    // Send packet
-    SendPacket(color_buf, 6);
+    command.light   = light;
+    command.step_ms = step_ms;
+    command.count   = std::min(count, (unsigned int)AMBX_SEQUENCE_STEPS);
+    memcpy(command.colors, colors, command.count * sizeof(RGBColor));
+    
+    if(!command_ring.Push(command))
+    {
+        stats.PacketsSkipped(1);
+        return false;
+    }
+    
+    // Only the first command queued after the writer caught up needs to wake it
+    if(command_count.fetch_add(1, std::memory_order_relaxed) == 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+        }
+        
+        writer_cv.notify_one();
+    }
     
-    // Add a small delay to ensure commands don't flood the device
-    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    return true;
 }
 
 /*---------------------------------------------------------*\
-| Function: SetAllColors                                     |
+| Function: QueueFadeToColor                                 |
 |                                                           |
-| Description: Sets all lights to the same color             |
+| Description: Queues a fade to the writer thread that      |
+|              plays it with a single sequence packet       |
 |                                                           |
 | Parameters:                                               |
-|   color - RGB color value to set for all lights           |
+|   light       - The ID of the light, or AMBX_LIGHT_ALL    |
+|   from        - Starting color                            |
+|   to          - Final color                               |
+|   duration_ms - Length of the fade in milliseconds        |
 |                                                           |
-| Returns: None                                             |
+| Returns: false if the command queue was full              |
 \*---------------------------------------------------------*/
-void AMBXController::SetAllColors(RGBColor color)
+bool AMBXController::QueueFadeToColor(unsigned int light, RGBColor from, RGBColor to, unsigned int duration_ms)
 {
-    unsigned int leds[] = 
-    { 
-        AMBX_LIGHT_LEFT,
-        AMBX_LIGHT_RIGHT,
-        AMBX_LIGHT_WALL_LEFT,
-        AMBX_LIGHT_WALL_CENTER,
-        AMBX_LIGHT_WALL_RIGHT
-    };
+    RGBColor steps[AMBX_SEQUENCE_STEPS];
     
-    RGBColor colors[] = { color, color, color, color, color };
+    BuildFade(from, to, steps);
     
-    SetLEDColors(leds, colors, 5);
+    return QueueColorSequence(light, duration_ms / AMBX_SEQUENCE_STEPS, steps, AMBX_SEQUENCE_STEPS);
 }
 
 /*---------------------------------------------------------*\
-| Function: SetLEDColor                                      |
+| Function: StartSequence                                    |
 |                                                           |
-| Description: Sets a specific LED to a color                |
+| Description: Has the writer thread play a sequence on all |
+|              lights, uploading it again each time it      |
+|              finishes, until StopSequence is called       |
 |                                                           |
 | Parameters:                                               |
-|   led   - The ID of the LED to set                        |
-|   color - RGB color value                                 |
+|   colors  - Array of up to AMBX_SEQUENCE_STEPS colors     |
+|   count   - Number of colors in the array                 |
+|   step_ms - Time spent on each step in milliseconds       |
 |                                                           |
 | Returns: None                                             |
 \*---------------------------------------------------------*/
-void AMBXController::SetLEDColor(unsigned int led, RGBColor color)
+void AMBXController::StartSequence(RGBColor* colors, unsigned int count, unsigned int step_ms)
 {
-    if(!initialized)
+    if(count == 0)
     {
-        LOG_ERROR("Cannot set LED color - AMBX device not initialized");
+        StopSequence();
         return;
     }
     
-    LOG_DEBUG("Setting LED 0x%02X to RGB: %d,%d,%d", 
-             led, 
-             RGBGetRValue(color), 
-             RGBGetGValue(color), 
-             RGBGetBValue(color));
-             
-    // Validate LED ID before setting color
-    if(led != AMBX_LIGHT_LEFT && 
-       led != AMBX_LIGHT_RIGHT && 
-       led != AMBX_LIGHT_WALL_LEFT && 
-       led != AMBX_LIGHT_WALL_CENTER && 
-       led != AMBX_LIGHT_WALL_RIGHT && 
-       led != AMBX_LIGHT_ALL)
-    {
-        LOG_ERROR("Invalid AMBX LED ID: 0x%02X", led);
-        return;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        
+        for(unsigned int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
+        {
+            sequence_colors[step] = colors[std::min(step, count - 1)];
+        }
+        
+        sequence_step_ms = std::max(step_ms, 1u);
+        sequence_active  = true;
+        sequence_changed = true;
     }
     
-    SetSingleColor(led, RGBGetRValue(color), RGBGetGValue(color), RGBGetBValue(color));
+    writer_cv.notify_one();
 }
 
 /*---------------------------------------------------------*\
-| Function: SetLEDColors                                     |
-|                                                           |
-| Description: Sets multiple LEDs to different colors        |
+| Function: StopSequence                                     |
 |                                                           |
-| Parameters:                                               |
-|   leds   - Array of LED IDs                               |
-|   colors - Array of RGB color values                      |
-|   count  - Number of LEDs to set                          |
+| Description: Stops the sequence started by StartSequence  |
 |                                                           |
 | Returns: None                                             |
 \*---------------------------------------------------------*/
-void AMBXController::SetLEDColors(unsigned int* leds, RGBColor* colors, unsigned int count)
+void AMBXController::StopSequence()
 {
-    // Simple approach: just send individual commands for each light
-    for(unsigned int i = 0; i < count; i++)
     {
-        SetLEDColor(leds[i], colors[i]);
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        
+        if(!sequence_active)
+        {
+            return;
+        }
         
-        // Small delay between commands
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        sequence_active  = false;
+        sequence_changed = true;
     }
+    
+    writer_cv.notify_one();
 }
-
-
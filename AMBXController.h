@@ -32,15 +32,21 @@
 #pragma once
 
 #include "RGBController.h"
+#include "AMBXTransport.h"
+#include "AMBXCommandRing.h"
+#include "AMBXFrameBarrier.h"
+#include "AMBXFrameScheduler.h"
+#include "AMBXLog.h"
+#include "AMBXStats.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-#ifdef _WIN32
-#include "dependencies/libusb-1.0.27/include/libusb.h"
-#else
-#include <libusb.h>
-#endif
-
 /*-----------------------------------------------------*\
 | AMBX VID/PID                                          |
 |                                                       |
@@ -73,6 +79,67 @@
 #define AMBX_SET_COLOR                      0x03
 #define AMBX_SET_COLOR_SEQUENCE             0x72
 
+/*-----------------------------------------------------*\
+| A SET_COLOR packet: header, light ID, command, RGB    |
+\*-----------------------------------------------------*/
+#define AMBX_COLOR_PACKET_SIZE              6
+
+/*-----------------------------------------------------*\
+| AMBX Color Sequences                                  |
+|                                                       |
+| A sequence packet has the following format:           |
+|   Byte 0:    Header (0xA1)                            |
+|   Byte 1:    Light ID                                 |
+|   Byte 2:    Command (0x72)                           |
+|   Bytes 3-4: Time per step in ms (big endian)         |
+|   Bytes 5+:  16 RGB steps the device fades through    |
+\*-----------------------------------------------------*/
+#define AMBX_SEQUENCE_STEPS                 16
+#define AMBX_SEQUENCE_PACKET_SIZE           (5 + (3 * AMBX_SEQUENCE_STEPS))
+
+/*-----------------------------------------------------*\
+| AMBX Pacing                                           |
+|                                                       |
+| Gap in microseconds enforced between packet submits.  |
+| The gap shrinks towards the minimum while transfers   |
+| complete promptly, grows when completions lag behind  |
+| the gap, and doubles on timeouts and pipe errors.     |
+| The minimum is the larger of the gap set through      |
+| SetMinimumPacketGap and the OUT endpoint's polling    |
+| interval, which is AMBX_PACING_MIN_GAP until the      |
+| device is open and its descriptor has been read.      |
+| Growth is at least one step, so a gap that has shrunk |
+| to a minimum of zero still backs off.                 |
+\*-----------------------------------------------------*/
+#define AMBX_PACING_MIN_GAP                 1000
+#define AMBX_PACING_INITIAL_GAP             2000
+#define AMBX_PACING_MAX_GAP                 50000
+#define AMBX_PACING_STEP                    125
+
+/*-----------------------------------------------------*\
+| AMBX Refresh                                          |
+|                                                       |
+| Lights whose color matches the last color sent are    |
+| skipped. As a safety net every light is resent at     |
+| this interval (in milliseconds) even if unchanged.    |
+\*-----------------------------------------------------*/
+#define AMBX_FULL_REFRESH_INTERVAL          5000
+
+/*-----------------------------------------------------*\
+| AMBX Multi-command packets                            |
+|                                                       |
+| Firmware that takes several commands back to back in  |
+| one transfer can be sent a whole frame as a single    |
+| packet. When asked to, a controller probes its device |
+| once at open with a packet of black SET_COLOR         |
+| commands repeating the blackout, and the result is    |
+| kept per serial for the rest of the session. The      |
+| probe only sees transfers being rejected, not         |
+| commands past the first being ignored, so it is       |
+| opt-in. The probe waits this long (ms) to complete.   |
+\*-----------------------------------------------------*/
+#define AMBX_MULTI_COMMAND_PROBE_TIMEOUT    (2 * AMBX_TRANSFER_TIMEOUT)
+
 /*-----------------------------------------------------*\
 | AMBX Lights                                           |
 |                                                       |
@@ -94,12 +161,181 @@ enum
     AMBX_LIGHT_ALL          = 0xFF
 };
 
+/*-----------------------------------------------------*\
+| Number of individually addressable lights             |
+\*-----------------------------------------------------*/
+#define AMBX_LIGHT_COUNT                    5
+
+/*-----------------------------------------------------*\
+| Typed light IDs                                       |
+|                                                       |
+| A raw ID is checked once, against ambx_light_lookup,  |
+| where it enters the driver. Everything past that      |
+| point takes an AMBXLight and sends without checking   |
+| again.                                                |
+\*-----------------------------------------------------*/
+enum class AMBXLight : unsigned char
+{
+    Left                    = AMBX_LIGHT_LEFT,
+    Right                   = AMBX_LIGHT_RIGHT,
+    WallLeft                = AMBX_LIGHT_WALL_LEFT,
+    WallCenter              = AMBX_LIGHT_WALL_CENTER,
+    WallRight               = AMBX_LIGHT_WALL_RIGHT,
+    All                     = AMBX_LIGHT_ALL
+};
+
+/*-----------------------------------------------------*\
+| Lights in mailbox and shadow slot order               |
+\*-----------------------------------------------------*/
+constexpr AMBXLight ambx_light_order[AMBX_LIGHT_COUNT] =
+{
+    AMBXLight::Left,
+    AMBXLight::Right,
+    AMBXLight::WallLeft,
+    AMBXLight::WallCenter,
+    AMBXLight::WallRight
+};
+
+/*-----------------------------------------------------*\
+| Light lookup table                                    |
+|                                                       |
+| One entry per possible ID byte, built at compile      |
+| time. Valid IDs hold their slot, the broadcast ID     |
+| holds AMBX_LIGHT_SLOT_ALL.                            |
+\*-----------------------------------------------------*/
+#define AMBX_LIGHT_SLOT_ALL                 AMBX_LIGHT_COUNT
+
+typedef struct
+{
+    unsigned char           slot;
+    bool                    valid;
+} ambx_light_entry;
+
+typedef struct
+{
+    ambx_light_entry        entries[256];
+} ambx_light_table;
+
+constexpr ambx_light_table BuildAMBXLightTable()
+{
+    ambx_light_table table = {};
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        table.entries[static_cast<unsigned char>(ambx_light_order[slot])].slot  = (unsigned char)slot;
+        table.entries[static_cast<unsigned char>(ambx_light_order[slot])].valid = true;
+    }
+    
+    table.entries[AMBX_LIGHT_ALL].slot  = AMBX_LIGHT_SLOT_ALL;
+    table.entries[AMBX_LIGHT_ALL].valid = true;
+    
+    return table;
+}
+
+constexpr ambx_light_table ambx_light_lookup = BuildAMBXLightTable();
+
+/*-----------------------------------------------------*\
+| Whether an ID is a light or the broadcast ID          |
+\*-----------------------------------------------------*/
+constexpr bool IsAMBXLight(unsigned int light)
+{
+    return light < 256 && ambx_light_lookup.entries[light].valid;
+}
+
+/*-----------------------------------------------------*\
+| Slot of a single light, or -1 for the broadcast ID    |
+| and invalid IDs                                       |
+\*-----------------------------------------------------*/
+constexpr int GetAMBXLightSlot(unsigned int light)
+{
+    return (IsAMBXLight(light) && light != AMBX_LIGHT_ALL) ? ambx_light_lookup.entries[light].slot : -1;
+}
+
+static_assert(GetAMBXLightSlot(AMBX_LIGHT_LEFT) == 0 && GetAMBXLightSlot(AMBX_LIGHT_WALL_RIGHT) == AMBX_LIGHT_COUNT - 1, "amBX light slots out of order");
+static_assert(IsAMBXLight(AMBX_LIGHT_ALL) && GetAMBXLightSlot(AMBX_LIGHT_ALL) == -1, "amBX broadcast ID is not a single light");
+static_assert(!IsAMBXLight(0x00) && !IsAMBXLight(0x5B) && !IsAMBXLight(0x10B), "amBX light table accepts invalid IDs");
+
+/*-----------------------------------------------------*\
+| AMBX Modes                                            |
+|                                                       |
+| Breathing and Spectrum Cycle run as color sequences   |
+| interpolated by the device. Speed sets the time per   |
+| sequence step as AMBX_SPEED_STEP_TIME / speed ms.     |
+\*-----------------------------------------------------*/
+enum
+{
+    AMBX_MODE_DIRECT            = 0x00,
+    AMBX_MODE_BREATHING         = 0x01,
+    AMBX_MODE_SPECTRUM_CYCLE    = 0x02
+};
+
+enum
+{
+    AMBX_SPEED_SLOWEST          = 0x01,
+    AMBX_SPEED_NORMAL           = 0x04,
+    AMBX_SPEED_FASTEST          = 0x0A
+};
+
+#define AMBX_SPEED_STEP_TIME                1000
+
+/*-----------------------------------------------------*\
+| AMBX Command Queue                                    |
+|                                                       |
+| One-shot commands such as fades are queued to the     |
+| writer thread through a lock-free ring and sent in    |
+| order ahead of the next frame. When the ring is full  |
+| the new command is dropped. The depth must be a power |
+| of two.                                               |
+\*-----------------------------------------------------*/
+#define AMBX_COMMAND_QUEUE_DEPTH            32
+
+typedef struct
+{
+    unsigned int            light;
+    unsigned int            step_ms;
+    RGBColor                colors[AMBX_SEQUENCE_STEPS];
+    unsigned int            count;
+} ambx_command;
+
+/*-----------------------------------------------------*\
+| Frame batch                                           |
+|                                                       |
+| The SET_COLOR packets of one frame, back to back in a |
+| single cache line, built in one pass over the frame's |
+| colors and then submitted one after another, or as    |
+| runs of several commands per transfer when the device |
+| takes them.                                           |
+\*-----------------------------------------------------*/
+typedef struct alignas(64)
+{
+    unsigned char           packets[AMBX_LIGHT_COUNT][AMBX_COLOR_PACKET_SIZE];
+    unsigned int            count;
+} AMBXFrameBatch;
+
+static_assert(sizeof(AMBXFrameBatch) == 64, "AMBXFrameBatch should fill exactly one cache line");
+
+/*-----------------------------------------------------*\
+| A lazily opened device that cannot be opened is tried |
+| this many times, waiting AMBX_OPEN_RETRY_DELAY ms     |
+| after the first failure and twice as long after each  |
+| one after that                                        |
+\*-----------------------------------------------------*/
+#define AMBX_OPEN_ATTEMPTS                  5
+#define AMBX_OPEN_RETRY_DELAY               250
+
+/*-----------------------------------------------------*\
+| Time in milliseconds the destructor waits for the     |
+| writer thread before dropping its remaining packets   |
+\*-----------------------------------------------------*/
+#define AMBX_WRITER_STOP_TIMEOUT            250
+
 class AMBXController
 {
 public:
     AMBXController(const char* path);
+    AMBXController(AMBXTransport* transport_ptr, bool lazy_open = false, bool multi_command = false);
     ~AMBXController();
-
+    
     std::string     GetDeviceLocation();
     std::string     GetSerialString();
     
@@ -108,14 +344,207 @@ public:
     void            SetAllColors(RGBColor color);
     void            SetLEDColor(unsigned int led, RGBColor color);
     void            SetLEDColors(unsigned int* leds, RGBColor* colors, unsigned int count);
+    
+    void            QueueLEDColor(unsigned int led, RGBColor color);
+    void            QueueLEDColors(unsigned int* leds, RGBColor* colors, unsigned int count);
+    
+    void            SetColorSequence(unsigned int light, unsigned int step_ms, RGBColor* colors, unsigned int count);
+    void            FadeToColor(unsigned int light, RGBColor from, RGBColor to, unsigned int duration_ms);
+    
+    bool            QueueColorSequence(unsigned int light, unsigned int step_ms, RGBColor* colors, unsigned int count);
+    bool            QueueFadeToColor(unsigned int light, RGBColor from, RGBColor to, unsigned int duration_ms);
+    
+    void            StartSequence(RGBColor* colors, unsigned int count, unsigned int step_ms);
+    void            StopSequence();
+    
+    unsigned long long  GetFramesSent();
+    unsigned long long  GetPacketsSent();
+    unsigned long long  GetPacketsSkipped();
+    AMBXStatsSnapshot   GetStats();
+    
+    void            SetFrameBarrier(std::shared_ptr<AMBXFrameBarrier> barrier);
+    AMBXBarrierStats GetBarrierStats();
+    
+    void            SetMinimumPacketGap(unsigned int gap_us);
+    unsigned int    GetMinimumPacketGap();
+    unsigned int    GetPacketGap();
+    unsigned int    GetPacketRate();
+    unsigned int    GetCommandsPerPacket();
+    
+    void            SetPacingSpin(unsigned int spin_us);
+    AMBXSchedulerStats GetPacingJitter();
+    
+    static void     BuildColorPacket(unsigned char* packet, AMBXLight light, RGBColor color);
+    static void     BuildFrameBatch(AMBXFrameBatch& batch, const RGBColor* colors, unsigned int mask);
 
 private:
-    libusb_context*          usb_context;
-    libusb_device_handle*    dev_handle;
+    AMBXTransport*           transport;
     std::string              location;
     std::string              serial;
-    bool                     initialized;
-    bool                     interface_claimed;
+    bool                     serial_known;
+    std::atomic<bool>        initialized;
+    unsigned int             max_packet_size;
+    
+    /*-----------------------------------------------------*\
+    | A lazily opened controller only holds its transport   |
+    | until the writer thread opens it. Set once the open   |
+    | has succeeded or finally failed, after which serial   |
+    | and max_packet_size are valid. serial_known is set in |
+    | the constructor if the serial was read before that.   |
+    \*-----------------------------------------------------*/
+    std::mutex                      open_mutex;
+    std::atomic<bool>               opened;
+    
+    bool                    EnsureOpen(bool last_attempt = true);
+    bool                    OpenWithRetry();
+    
+    /*-----------------------------------------------------*\
+    | SET_COLOR commands sent per transfer, 1 unless        |
+    | multi_command was asked for and the probe passed, and |
+    | never more than fit in max_packet_size, so a batch    |
+    | of commands stays within one transaction. Written     |
+    | before opened is set, and by the writer thread again  |
+    | when a replugged device was attached, which sets      |
+    | endpoint_changed under writer_mutex.                  |
+    \*-----------------------------------------------------*/
+    bool                            multi_command;
+    std::atomic<unsigned int>       commands_per_packet;
+    bool                            endpoint_changed;
+    
+    void                    ReadEndpoint();
+    unsigned int            ProbeMultiCommand();
+    
+    /*-----------------------------------------------------*\
+    | Cleared while the device is unplugged. Packets are    |
+    | dropped quietly until it comes back, then the last    |
+    | frame or sequence is sent again.                      |
+    \*-----------------------------------------------------*/
+    std::atomic<bool>               connected;
+    
+    void                    TransferComplete(const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency);
+    void                    ConnectionChanged(bool now_connected);
+    
+    static void             TransferCallback(void* callback_arg, const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency);
+    static void             ConnectionCallback(void* callback_arg, bool now_connected);
+    
+    /*-----------------------------------------------------*\
+    | Latest-wins frame mailbox                             |
+    |                                                       |
+    | Producers store each light's newest color into its    |
+    | slot and set the matching bit in mailbox_pending.     |
+    | The writer thread swaps the mask out and sends only   |
+    | the newest color of each flagged light, so frames     |
+    | published faster than the device accepts them are    |
+    | dropped rather than queued. A color can be newer than |
+    | the bit the writer swapped out, so colors are stored  |
+    | with release and loaded with acquire themselves.      |
+    \*-----------------------------------------------------*/
+    std::atomic<RGBColor>           mailbox_colors[AMBX_LIGHT_COUNT];
+    std::atomic<unsigned int>       mailbox_pending;
+    
+    unsigned int            StoreMailboxColor(AMBXLight light, RGBColor color);
+    void                    PublishMailbox(unsigned int mask);
+    
+    std::thread                     writer_thread;
+    std::atomic<bool>               writer_thread_run;
+    bool                            writer_thread_done;
+    std::atomic<bool>               writer_abort;
+    std::mutex                      writer_mutex;
+    std::condition_variable         writer_cv;
+    
+    /*-----------------------------------------------------*\
+    | One-shot commands pushed by any thread and popped by  |
+    | the writer. command_count is raised after each push   |
+    | and lowered once the writer has sent it, so only the  |
+    | push that finds it at zero has to wake the writer.    |
+    \*-----------------------------------------------------*/
+    AMBXCommandRing<ambx_command, AMBX_COMMAND_QUEUE_DEPTH> command_ring;
+    std::atomic<unsigned int>       command_count;
+    
+    /*-----------------------------------------------------*\
+    | Optional barrier shared with other controllers, set   |
+    | under writer_mutex. The writer thread joins it while  |
+    | it is sending direct frames to a connected device and |
+    | leaves it otherwise, joined_barrier is the one it is  |
+    | a member of. The completion of the last packet of     |
+    | each released frame is reported back to it.           |
+    \*-----------------------------------------------------*/
+    std::shared_ptr<AMBXFrameBarrier> frame_barrier;
+    bool                            barrier_changed;
+    std::shared_ptr<AMBXFrameBarrier> joined_barrier;
+    std::mutex                      wire_mutex;
+    std::shared_ptr<AMBXFrameBarrier> wire_barrier;
+    unsigned long long              wire_generation;
+    unsigned long long              wire_packet;
+    unsigned long long              packets_completed;
+    std::chrono::steady_clock::time_point last_completion_time;
+    
+    /*-----------------------------------------------------*\
+    | Number of the probe packet while one is in flight,    |
+    | its status once it completes, under wire_mutex        |
+    \*-----------------------------------------------------*/
+    unsigned long long              probe_packet;
+    bool                            probe_done;
+    libusb_transfer_status          probe_status;
+    std::condition_variable         probe_cv;
+    
+    /*-----------------------------------------------------*\
+    | Repeating sequence uploaded by the writer thread once |
+    | per period, guarded by writer_mutex                   |
+    \*-----------------------------------------------------*/
+    bool                            sequence_active;
+    bool                            sequence_changed;
+    RGBColor                        sequence_colors[AMBX_SEQUENCE_STEPS];
+    unsigned int                    sequence_step_ms;
+    
+    /*-----------------------------------------------------*\
+    | Shadow of the last color sent to each light. A bit in |
+    | shadow_valid is cleared when a transfer for that      |
+    | light fails so the light is sent again.               |
+    \*-----------------------------------------------------*/
+    std::atomic<RGBColor>           shadow_colors[AMBX_LIGHT_COUNT];
+    std::atomic<unsigned int>       shadow_valid;
+    
+    /*-----------------------------------------------------*\
+    | Frame, packet, error and latency counters             |
+    \*-----------------------------------------------------*/
+    AMBXStats                       stats;
+    
+    /*-----------------------------------------------------*\
+    | Keep a stalled or failing device from logging an      |
+    | error for every packet. The writer thread reports     |
+    | what they held back once the errors stop.             |
+    \*-----------------------------------------------------*/
+    AMBXLogLimiter                  submit_log_limiter;
+    AMBXLogLimiter                  transfer_log_limiter;
+    
+    void                    FlushSuppressedErrors();
+    
+    /*-----------------------------------------------------*\
+    | Pacing controller                                     |
+    \*-----------------------------------------------------*/
+    std::atomic<unsigned int>       configured_min_gap_us;
+    std::atomic<unsigned int>       endpoint_interval_us;
+    std::atomic<unsigned int>       min_packet_gap_us;
+    std::atomic<unsigned int>       packet_gap_us;
+    AMBXFrameScheduler              packet_scheduler;
+    std::chrono::steady_clock::time_point next_packet_time;
+    
+    void                    UpdateMinimumPacketGap();
+    void                    WaitForPacketGap();
+    void                    UpdatePacing(libusb_transfer_status status, std::chrono::steady_clock::duration latency);
+    
+    void                    UpdateShadow(unsigned int light, RGBColor color);
+    void                    InvalidateShadow(unsigned int light);
+    void                    PacketFailed(const unsigned char* packet, unsigned int size);
+    
+    void                    StartWriterThread();
+    void                    StopWriterThread();
+    void                    WriterThreadFunction();
+    void                    JoinFrameBarrier(std::shared_ptr<AMBXFrameBarrier> barrier);
     
     void                    SendPacket(unsigned char* packet, unsigned int size);
+    void                    SendBlackout();
+    void                    SendColorSequence(unsigned int light, unsigned int step_ms, const RGBColor* colors, unsigned int count);
+    void                    SendFrame(const RGBColor* colors, unsigned int mask, unsigned int updates);
 };
@@ -8,10 +8,14 @@
 \*---------------------------------------------------------*/
 
 #include "Detector.h"
-#include "LogManager.h"
+#include "AMBXLog.h"
 #include "AMBXController.h"
+#include "AMBXFrameBarrier.h"
+#include "AMBXTrace.h"
+#include "AMBXUSBTransport.h"
 #include "RGBController_AMBX.h"
 #include "ResourceManager.h"
+#include "SettingsManager.h"
 
 #ifdef _WIN32
 #include "dependencies/libusb-1.0.27/include/libusb.h"
@@ -35,33 +39,65 @@
 
 void DetectAMBXControllers()
 {
-    LOG_INFO("Detecting Philips amBX devices...");
+    AMBX_LOG_INFO("Detecting Philips amBX devices...");
     
     /*-------------------------------------*\
-    | Initialize libusb                     |
+    | Get the shared libusb context         |
     \*-------------------------------------*/
-    libusb_context* context = nullptr;
+    std::shared_ptr<AMBXUSBContext> context = AMBXUSBContext::Get();
     
-    // Initialize libusb for this detection
-    int init_result = libusb_init(&context);
-    if(init_result != LIBUSB_SUCCESS)
+    if(context == nullptr)
     {
-        LOG_ERROR("Failed to initialize libusb: %s", libusb_error_name(init_result));
         return;
     }
     
     // Get device list
     libusb_device** device_list;
-    ssize_t device_count = libusb_get_device_list(context, &device_list);
+    ssize_t device_count = libusb_get_device_list(context->GetContext(), &device_list);
     
     if(device_count < 0)
     {
-        LOG_ERROR("Failed to get USB device list: %s", libusb_error_name(static_cast<int>(device_count)));
-        libusb_exit(context);
+        AMBX_LOG_ERROR("Failed to get USB device list: %s", libusb_error_name(static_cast<int>(device_count)));
         return;
     }
     
     int detected_devices = 0;
+    int found_devices = 0;
+    
+    /*-------------------------------------*\
+    | Optionally release frames to all      |
+    | devices together                      |
+    \*-------------------------------------*/
+    json ambx_settings = ResourceManager::get()->GetSettingsManager()->GetSettings("AMBXSettings");
+    
+    std::shared_ptr<AMBXFrameBarrier> frame_barrier;
+    
+    if(ambx_settings.contains("sync_frames") && ambx_settings["sync_frames"].get<bool>())
+    {
+        frame_barrier = std::make_shared<AMBXFrameBarrier>();
+    }
+    
+    /*-------------------------------------*\
+    | Optionally leave opening the devices  |
+    | to their writer threads so detection  |
+    | does not wait on them                 |
+    \*-------------------------------------*/
+    bool lazy_open = ambx_settings.contains("lazy_open") && ambx_settings["lazy_open"].get<bool>();
+    
+    /*-------------------------------------*\
+    | Optionally probe for firmware taking  |
+    | a whole frame in one packet           |
+    \*-------------------------------------*/
+    bool multi_command = ambx_settings.contains("multi_command_packets") && ambx_settings["multi_command_packets"].get<bool>();
+    
+    /*-------------------------------------*\
+    | Optionally record a timeline of the   |
+    | update path                           |
+    \*-------------------------------------*/
+    if(ambx_settings.contains("trace_file"))
+    {
+        AMBXTrace::Enable(ambx_settings["trace_file"].get<std::string>());
+    }
     
     // Enumerate devices to find AMBX
     for(ssize_t i = 0; i < device_count; i++)
@@ -76,6 +112,8 @@ void DetectAMBXControllers()
         
         if(descriptor.idVendor == AMBX_VID && descriptor.idProduct == AMBX_PID)
         {
+            found_devices++;
+            
             // Get device path
             uint8_t bus = libusb_get_bus_number(device);
             uint8_t address = libusb_get_device_address(device);
@@ -83,62 +121,56 @@ void DetectAMBXControllers()
             char device_path[64];
             sprintf(device_path, "%d-%d", bus, address);
             
-            LOG_INFO("Found amBX device at bus %d, address %d", bus, address);
+            AMBX_LOG_INFO("Found amBX device at bus %d, address %d", bus, address);
             
-            // Create controller for this device
+            // Create controller for this device, the transport keeps its own reference to it
             try
             {
-                AMBXController* controller = new AMBXController(device_path);
+                AMBXController* controller = new AMBXController(new AMBXUSBTransport(context, device), lazy_open, multi_command);
                 
                 // Only register controller if it initialized successfully
                 if(controller->IsInitialized())
                 {
+                    if(frame_barrier != nullptr)
+                    {
+                        controller->SetFrameBarrier(frame_barrier);
+                    }
+                    
+                    if(ambx_settings.contains("pacing_spin_us"))
+                    {
+                        controller->SetPacingSpin(ambx_settings["pacing_spin_us"].get<unsigned int>());
+                    }
+                    
                     RGBController_AMBX* rgb_controller = new RGBController_AMBX(controller);
                     ResourceManager::get()->RegisterRGBController(rgb_controller);
                     detected_devices++;
                     
-                    LOG_INFO("Successfully added amBX device at %s", device_path);
+                    AMBX_LOG_INFO("Successfully added amBX device at %s", device_path);
                 }
                 else
                 {
-                    LOG_WARNING("Found amBX device at %s but initialization failed", device_path);
+                    AMBX_LOG_WARNING("Found amBX device at %s but initialization failed", device_path);
                     delete controller;
                 }
             }
             catch(const std::exception& e)
             {
-                LOG_ERROR("Exception creating AMBX controller at %s: %s", device_path, e.what());
+                AMBX_LOG_ERROR("Exception creating AMBX controller at %s: %s", device_path, e.what());
             }
         }
     }
     
-    if(detected_devices == 0)
+    libusb_free_device_list(device_list, 1);
+    
+    // Check if a device exists but can't be accessed
+    if(detected_devices == 0 && found_devices > 0)
     {
-        // Check if device exists but can't be accessed
-        for(ssize_t i = 0; i < device_count; i++)
-        {
-            libusb_device* device = device_list[i];
-            struct libusb_device_descriptor descriptor;
-            
-            if(libusb_get_device_descriptor(device, &descriptor) != LIBUSB_SUCCESS)
-            {
-                continue;
-            }
-            
-            if(descriptor.idVendor == AMBX_VID && descriptor.idProduct == AMBX_PID)
-            {
-                LOG_WARNING("AMBX device found but couldn't be accessed - check permissions");
-                LOG_WARNING("On Windows, please install WinUSB driver using Zadig tool");
-                LOG_WARNING("On Linux, ensure udev rules are properly installed");
-                break;
-            }
-        }
+        AMBX_LOG_WARNING("AMBX device found but couldn't be accessed - check permissions");
+        AMBX_LOG_WARNING("On Windows, please install WinUSB driver using Zadig tool");
+        AMBX_LOG_WARNING("On Linux, ensure udev rules are properly installed");
     }
     
-    libusb_free_device_list(device_list, 1);
-    libusb_exit(context);
-    
-    LOG_INFO("AMBX detection completed. Found %d devices.", detected_devices);
+    AMBX_LOG_INFO("AMBX detection completed. Found %d devices.", detected_devices);
 }
 
 REGISTER_DETECTOR("Philips amBX", DetectAMBXControllers);
@@ -0,0 +1,218 @@
+/*---------------------------------------------------------*\
+| AMBXFrameBarrier.cpp                                      |
+|                                                           |
+|   Frame barrier for Philips amBX Gaming lights            |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXFrameBarrier.h"
+#include <algorithm>
+
+AMBXFrameBarrier::AMBXFrameBarrier(unsigned int tick_timeout_us)
+{
+    tick_timeout = std::chrono::microseconds(tick_timeout_us);
+    members = 0;
+    arrived = 0;
+    generation = 0;
+    
+    ResetStats();
+}
+
+/*---------------------------------------------------------*\
+| Function: Join                                             |
+|                                                           |
+| Description: Adds a member whose frames are held until    |
+|              every member has staged one                  |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameBarrier::Join()
+{
+    std::lock_guard<std::mutex> lock(barrier_mutex);
+    
+    members++;
+}
+
+/*---------------------------------------------------------*\
+| Function: Leave                                            |
+|                                                           |
+| Description: Removes a member, releasing the others if    |
+|              they were only waiting for it                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameBarrier::Leave()
+{
+    std::lock_guard<std::mutex> lock(barrier_mutex);
+    
+    members = std::max(members, 1u) - 1;
+    
+    if(arrived > 0 && arrived >= members)
+    {
+        Release(false);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: Arrive                                           |
+|                                                           |
+| Description: Called by a member with a frame staged.      |
+|              Waits until every member has arrived or the  |
+|              tick timeout has passed since the first one  |
+|              did, then lets all of them send together.    |
+|                                                           |
+| Returns: The generation of the released frame, for        |
+|          reporting its wire time                          |
+\*---------------------------------------------------------*/
+unsigned long long AMBXFrameBarrier::Arrive()
+{
+    std::unique_lock<std::mutex> lock(barrier_mutex);
+    
+    unsigned long long frame_generation = generation;
+    
+    if(arrived == 0)
+    {
+        release_deadline = std::chrono::steady_clock::now() + tick_timeout;
+    }
+    
+    arrived++;
+    
+    if(arrived >= members)
+    {
+        Release(false);
+        return frame_generation;
+    }
+    
+    if(!barrier_cv.wait_until(lock, release_deadline, [this, frame_generation]
+    {
+        return generation != frame_generation;
+    }))
+    {
+        // The stragglers send their frame with the next release
+        Release(true);
+    }
+    
+    return frame_generation;
+}
+
+/*---------------------------------------------------------*\
+| Function: Release                                          |
+|                                                           |
+| Description: Lets every waiting member go, barrier_mutex  |
+|              must be held                                 |
+|                                                           |
+| Parameters:                                               |
+|   timed_out - Whether some members had not arrived        |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameBarrier::Release(bool timed_out)
+{
+    barrier_frame& frame = history[generation % AMBX_BARRIER_HISTORY];
+    
+    frame.generation = generation;
+    frame.reports    = 0;
+    
+    if(timed_out)
+    {
+        timeouts++;
+    }
+    
+    arrived = 0;
+    generation++;
+    
+    barrier_cv.notify_all();
+}
+
+/*---------------------------------------------------------*\
+| Function: ReportWireTime                                   |
+|                                                           |
+| Description: Records when a member's part of a released   |
+|              frame finished on the wire. Once every       |
+|              member has reported, the frame's skew is     |
+|              added to the statistics.                     |
+|                                                           |
+| Parameters:                                               |
+|   frame_generation - Generation returned by Arrive        |
+|   wire_time        - Completion time of the member's last |
+|                      packet of the frame                  |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameBarrier::ReportWireTime(unsigned long long frame_generation, std::chrono::steady_clock::time_point wire_time)
+{
+    std::lock_guard<std::mutex> lock(barrier_mutex);
+    
+    barrier_frame& frame = history[frame_generation % AMBX_BARRIER_HISTORY];
+    
+    // Too old, the slot has been reused
+    if(frame.generation != frame_generation || members < 2)
+    {
+        return;
+    }
+    
+    if(frame.reports == 0)
+    {
+        frame.first = wire_time;
+        frame.last  = wire_time;
+    }
+    else
+    {
+        frame.first = std::min(frame.first, wire_time);
+        frame.last  = std::max(frame.last, wire_time);
+    }
+    
+    frame.reports++;
+    
+    if(frame.reports == members)
+    {
+        unsigned int skew = (unsigned int)std::chrono::duration_cast<std::chrono::microseconds>(frame.last - frame.first).count();
+        
+        last_skew_us   = skew;
+        max_skew_us    = std::max(max_skew_us, skew);
+        total_skew_us += skew;
+        skew_samples++;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: GetStats                                         |
+|                                                           |
+| Description: Reads the skew and release counters          |
+|                                                           |
+| Returns: The current statistics                           |
+\*---------------------------------------------------------*/
+AMBXBarrierStats AMBXFrameBarrier::GetStats()
+{
+    std::lock_guard<std::mutex> lock(barrier_mutex);
+    
+    AMBXBarrierStats barrier_stats;
+    
+    barrier_stats.members         = members;
+    barrier_stats.last_skew_us    = last_skew_us;
+    barrier_stats.max_skew_us     = max_skew_us;
+    barrier_stats.average_skew_us = (skew_samples > 0) ? (unsigned int)(total_skew_us / skew_samples) : 0;
+    barrier_stats.frames_released = generation;
+    barrier_stats.timeouts        = timeouts;
+    
+    return barrier_stats;
+}
+
+void AMBXFrameBarrier::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(barrier_mutex);
+    
+    for(unsigned int frame_idx = 0; frame_idx < AMBX_BARRIER_HISTORY; frame_idx++)
+    {
+        history[frame_idx].generation = (unsigned long long)-1;
+        history[frame_idx].reports    = 0;
+    }
+    
+    last_skew_us  = 0;
+    max_skew_us   = 0;
+    total_skew_us = 0;
+    skew_samples  = 0;
+    timeouts      = 0;
+}
@@ -0,0 +1,99 @@
+/*---------------------------------------------------------*\
+| AMBXFrameBarrier.h                                        |
+|                                                           |
+|   Frame barrier for Philips amBX Gaming lights            |
+|                                                           |
+|   Lets several amBX controllers run as one display. Each  |
+|   member's writer thread stages its next frame and waits  |
+|   at the barrier, and the frame is released to every     |
+|   member's USB queue together once all of them have       |
+|   staged or the tick timeout has passed. Members report   |
+|   when each released frame reaches the wire, which gives  |
+|   the skew between devices. A controller only counts as a |
+|   member while it has direct frames to send.              |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/*-----------------------------------------------------*\
+| Time in microseconds the barrier holds staged frames  |
+| waiting for the remaining members                     |
+\*-----------------------------------------------------*/
+#define AMBX_BARRIER_TICK_TIMEOUT           10000
+
+/*-----------------------------------------------------*\
+| Time in milliseconds a member may go without a frame  |
+| before it leaves the barrier until its next one, so   |
+| an idle device does not hold the others up            |
+\*-----------------------------------------------------*/
+#define AMBX_BARRIER_IDLE_TIMEOUT           100
+
+/*-----------------------------------------------------*\
+| Number of recent frames whose wire times are tracked  |
+| while waiting for every member to report              |
+\*-----------------------------------------------------*/
+#define AMBX_BARRIER_HISTORY                16
+
+/*-----------------------------------------------------*\
+| Skew is the largest difference in wire time between   |
+| members for one frame, over frames every member sent. |
+| Timeouts counts releases that went ahead without      |
+| every member.                                         |
+\*-----------------------------------------------------*/
+typedef struct
+{
+    unsigned int            members;
+    unsigned int            last_skew_us;
+    unsigned int            max_skew_us;
+    unsigned int            average_skew_us;
+    unsigned long long      frames_released;
+    unsigned long long      timeouts;
+} AMBXBarrierStats;
+
+class AMBXFrameBarrier
+{
+public:
+    AMBXFrameBarrier(unsigned int tick_timeout_us = AMBX_BARRIER_TICK_TIMEOUT);
+
+    void                    Join();
+    void                    Leave();
+
+    unsigned long long      Arrive();
+    void                    ReportWireTime(unsigned long long generation, std::chrono::steady_clock::time_point wire_time);
+
+    AMBXBarrierStats        GetStats();
+    void                    ResetStats();
+
+private:
+    typedef struct
+    {
+        unsigned long long                      generation;
+        unsigned int                            reports;
+        std::chrono::steady_clock::time_point   first;
+        std::chrono::steady_clock::time_point   last;
+    } barrier_frame;
+
+    std::mutex                      barrier_mutex;
+    std::condition_variable         barrier_cv;
+    std::chrono::microseconds       tick_timeout;
+    unsigned int                    members;
+    unsigned int                    arrived;
+    unsigned long long              generation;
+    std::chrono::steady_clock::time_point release_deadline;
+
+    barrier_frame                   history[AMBX_BARRIER_HISTORY];
+    unsigned int                    last_skew_us;
+    unsigned int                    max_skew_us;
+    unsigned long long              total_skew_us;
+    unsigned long long              skew_samples;
+    unsigned long long              timeouts;
+
+    void                    Release(bool timed_out);
+};
@@ -0,0 +1,183 @@
+/*---------------------------------------------------------*\
+| AMBXFrameScheduler.cpp                                    |
+|                                                           |
+|   Absolute deadline scheduler for Philips amBX Gaming     |
+|   lights                                                  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXFrameScheduler.h"
+#include <algorithm>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <time.h>
+#endif
+
+AMBXFrameScheduler::AMBXFrameScheduler(unsigned int new_spin_us)
+{
+    SetSpin(new_spin_us);
+    ResetStats();
+}
+
+void AMBXFrameScheduler::SetSpin(unsigned int new_spin_us)
+{
+    spin_us.store(std::min(new_spin_us, (unsigned int)AMBX_SCHEDULER_MAX_SPIN), std::memory_order_relaxed);
+}
+
+unsigned int AMBXFrameScheduler::GetSpin()
+{
+    return spin_us.load(std::memory_order_relaxed);
+}
+
+/*---------------------------------------------------------*\
+| Function: SleepUntil                                       |
+|                                                           |
+| Description: Sleeps until the deadline, busy-waiting the  |
+|              last spin_us of it, and records how late the |
+|              wait woke up. Returns at once for deadlines  |
+|              already passed, which are not recorded.      |
+|                                                           |
+| Parameters:                                               |
+|   deadline - Absolute time to wake up at                  |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameScheduler::SleepUntil(std::chrono::steady_clock::time_point deadline)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    
+    if(now >= deadline)
+    {
+        return;
+    }
+    
+    std::chrono::microseconds spin(spin_us.load(std::memory_order_relaxed));
+    
+    if(deadline - now > spin)
+    {
+        SleepUntilSystem(deadline - spin);
+    }
+    
+    do
+    {
+        now = std::chrono::steady_clock::now();
+    } while(now < deadline);
+    
+    RecordLateness(now - deadline);
+}
+
+/*---------------------------------------------------------*\
+| Function: SleepUntilSystem                                 |
+|                                                           |
+| Description: Blocks until the deadline using the best     |
+|              absolute sleep the platform has              |
+|                                                           |
+| Parameters:                                               |
+|   deadline - Absolute time to wake up at                  |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameScheduler::SleepUntilSystem(std::chrono::steady_clock::time_point deadline)
+{
+#ifdef __linux__
+    /*-----------------------------------------------------*\
+    | steady_clock counts CLOCK_MONOTONIC on Linux, so the  |
+    | deadline can be handed to the kernel as it is         |
+    \*-----------------------------------------------------*/
+    std::chrono::nanoseconds since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch());
+    
+    struct timespec wake_time;
+    wake_time.tv_sec  = (time_t)(since_epoch.count() / 1000000000);
+    wake_time.tv_nsec = (long)(since_epoch.count() % 1000000000);
+    
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, nullptr) == EINTR)
+    {
+    }
+#else
+    std::this_thread::sleep_until(deadline);
+#endif
+}
+
+/*---------------------------------------------------------*\
+| Function: RecordLateness                                   |
+|                                                           |
+| Description: Adds one wake up to the statistics           |
+|                                                           |
+| Parameters:                                               |
+|   late - Time between the deadline and the wake up        |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXFrameScheduler::RecordLateness(std::chrono::steady_clock::duration late)
+{
+    unsigned int late_us = (unsigned int)std::chrono::duration_cast<std::chrono::microseconds>(late).count();
+    unsigned int bucket  = std::min(late_us / AMBX_SCHEDULER_BUCKET_WIDTH, (unsigned int)AMBX_SCHEDULER_BUCKETS - 1);
+    
+    waits.fetch_add(1, std::memory_order_relaxed);
+    total_late_us.fetch_add(late_us, std::memory_order_relaxed);
+    late_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    
+    unsigned int max = max_late_us.load(std::memory_order_relaxed);
+    
+    while(late_us > max && !max_late_us.compare_exchange_weak(max, late_us, std::memory_order_relaxed))
+    {
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: GetStats                                         |
+|                                                           |
+| Description: Summarizes how late waits have woken up      |
+|              since the last reset. The 99th percentile is |
+|              the upper edge of its histogram bucket.      |
+|                                                           |
+| Returns: The wake up statistics                           |
+\*---------------------------------------------------------*/
+AMBXSchedulerStats AMBXFrameScheduler::GetStats()
+{
+    AMBXSchedulerStats stats;
+    
+    stats.waits      = waits.load(std::memory_order_relaxed);
+    stats.max_us     = max_late_us.load(std::memory_order_relaxed);
+    stats.average_us = 0;
+    stats.p99_us     = 0;
+    
+    if(stats.waits == 0)
+    {
+        return stats;
+    }
+    
+    stats.average_us = (unsigned int)(total_late_us.load(std::memory_order_relaxed) / stats.waits);
+    
+    unsigned long long target = stats.waits - (stats.waits / 100);
+    unsigned long long seen   = 0;
+    
+    for(unsigned int bucket = 0; bucket < AMBX_SCHEDULER_BUCKETS; bucket++)
+    {
+        seen += late_histogram[bucket].load(std::memory_order_relaxed);
+        
+        if(seen >= target)
+        {
+            stats.p99_us = std::min((bucket + 1) * AMBX_SCHEDULER_BUCKET_WIDTH, stats.max_us);
+            break;
+        }
+    }
+    
+    return stats;
+}
+
+void AMBXFrameScheduler::ResetStats()
+{
+    waits.store(0, std::memory_order_relaxed);
+    total_late_us.store(0, std::memory_order_relaxed);
+    max_late_us.store(0, std::memory_order_relaxed);
+    
+    for(unsigned int bucket = 0; bucket < AMBX_SCHEDULER_BUCKETS; bucket++)
+    {
+        late_histogram[bucket].store(0, std::memory_order_relaxed);
+    }
+}
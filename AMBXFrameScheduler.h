@@ -0,0 +1,67 @@
+/*---------------------------------------------------------*\
+| AMBXFrameScheduler.h                                      |
+|                                                           |
+|   Absolute deadline scheduler for Philips amBX Gaming     |
+|   lights                                                  |
+|                                                           |
+|   Sleeps until an absolute point in time rather than for  |
+|   a duration, so oversleeping on one wait does not carry  |
+|   over into the next. On Linux this uses clock_nanosleep  |
+|   with TIMER_ABSTIME on CLOCK_MONOTONIC. The last few     |
+|   microseconds can optionally be busy-waited to cut wake  |
+|   up latency. How late each wait wakes up is recorded.    |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+/*-----------------------------------------------------*\
+| Wake up lateness is kept in a histogram of            |
+| AMBX_SCHEDULER_BUCKET_WIDTH us buckets, the last one  |
+| collecting everything later than that                 |
+\*-----------------------------------------------------*/
+#define AMBX_SCHEDULER_BUCKETS              256
+#define AMBX_SCHEDULER_BUCKET_WIDTH         10
+
+/*-----------------------------------------------------*\
+| Longest busy-wait allowed before a deadline, in us    |
+\*-----------------------------------------------------*/
+#define AMBX_SCHEDULER_MAX_SPIN             1000
+
+typedef struct
+{
+    unsigned long long      waits;
+    unsigned int            average_us;
+    unsigned int            p99_us;
+    unsigned int            max_us;
+} AMBXSchedulerStats;
+
+class AMBXFrameScheduler
+{
+public:
+    AMBXFrameScheduler(unsigned int spin_us = 0);
+
+    void                    SetSpin(unsigned int spin_us);
+    unsigned int            GetSpin();
+
+    void                    SleepUntil(std::chrono::steady_clock::time_point deadline);
+
+    AMBXSchedulerStats      GetStats();
+    void                    ResetStats();
+
+private:
+    std::atomic<unsigned int>       spin_us;
+
+    std::atomic<unsigned long long> waits;
+    std::atomic<unsigned long long> total_late_us;
+    std::atomic<unsigned int>       max_late_us;
+    std::atomic<unsigned int>       late_histogram[AMBX_SCHEDULER_BUCKETS];
+
+    void                    SleepUntilSystem(std::chrono::steady_clock::time_point deadline);
+    void                    RecordLateness(std::chrono::steady_clock::duration late);
+};
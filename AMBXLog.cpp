@@ -0,0 +1,149 @@
+/*---------------------------------------------------------*\
+| AMBXLog.cpp                                               |
+|                                                           |
+|   Logging for Philips amBX Gaming lights                  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXLog.h"
+#include <chrono>
+
+AMBXLogLimiter::AMBXLogLimiter()
+{
+    for(unsigned int slot = 0; slot < AMBX_LOG_LIMITER_KEYS; slot++)
+    {
+        keys[slot].key              = AMBX_LOG_LIMITER_NO_KEY;
+        keys[slot].last_log_ms      = 0;
+        keys[slot].suppressed_count = 0;
+    }
+}
+
+long long AMBXLogLimiter::NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*---------------------------------------------------------*\
+| Function: ShouldLog                                        |
+|                                                           |
+| Description: Decides whether an error is logged. An error |
+|              whose key was logged less than the interval  |
+|              ago is counted instead. A key not seen yet   |
+|              takes a free slot, or that of the key logged |
+|              longest ago. Threads racing on the first     |
+|              error of a burst may each log it once.       |
+|                                                           |
+| Parameters:                                               |
+|   key        - Identifies identical errors, such as the   |
+|                libusb error code                          |
+|   suppressed - Set to the errors with this key suppressed |
+|                since it was last logged                   |
+|                                                           |
+| Returns: true if the error should be logged               |
+\*---------------------------------------------------------*/
+bool AMBXLogLimiter::ShouldLog(int key, unsigned int& suppressed)
+{
+    long long     now_ms = NowMs();
+    ambx_log_key* oldest = &keys[0];
+    
+    for(unsigned int slot = 0; slot < AMBX_LOG_LIMITER_KEYS; slot++)
+    {
+        ambx_log_key& entry = keys[slot];
+        
+        if(entry.key.load(std::memory_order_relaxed) == key)
+        {
+            if(now_ms - entry.last_log_ms.load(std::memory_order_relaxed) < AMBX_LOG_REPEAT_INTERVAL)
+            {
+                entry.suppressed_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            
+            entry.last_log_ms.store(now_ms, std::memory_order_relaxed);
+            suppressed = entry.suppressed_count.exchange(0, std::memory_order_relaxed);
+            
+            return true;
+        }
+        
+        // Free slots are never logged, so they count as the oldest
+        if(oldest->key.load(std::memory_order_relaxed) != AMBX_LOG_LIMITER_NO_KEY &&
+           (entry.key.load(std::memory_order_relaxed) == AMBX_LOG_LIMITER_NO_KEY ||
+            entry.last_log_ms.load(std::memory_order_relaxed) < oldest->last_log_ms.load(std::memory_order_relaxed)))
+        {
+            oldest = &entry;
+        }
+    }
+    
+    oldest->key.store(key, std::memory_order_relaxed);
+    oldest->last_log_ms.store(now_ms, std::memory_order_relaxed);
+    oldest->suppressed_count.store(0, std::memory_order_relaxed);
+    suppressed = 0;
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: TakeSuppressed                                   |
+|                                                           |
+| Description: Hands out the count of one key whose errors  |
+|              were suppressed and whose interval is over,  |
+|              so it can be logged even if the error does   |
+|              not come back. Call it until it returns      |
+|              false.                                       |
+|                                                           |
+| Parameters:                                               |
+|   key        - Set to the key of the errors               |
+|   suppressed - Set to how many were suppressed            |
+|                                                           |
+| Returns: true if a count was taken                        |
+\*---------------------------------------------------------*/
+bool AMBXLogLimiter::TakeSuppressed(int& key, unsigned int& suppressed)
+{
+    long long now_ms = NowMs();
+    
+    for(unsigned int slot = 0; slot < AMBX_LOG_LIMITER_KEYS; slot++)
+    {
+        ambx_log_key& entry = keys[slot];
+        
+        if(entry.suppressed_count.load(std::memory_order_relaxed) == 0 ||
+           now_ms - entry.last_log_ms.load(std::memory_order_relaxed) < AMBX_LOG_REPEAT_INTERVAL)
+        {
+            continue;
+        }
+        
+        // Reporting the count starts a new interval for the key
+        entry.last_log_ms.store(now_ms, std::memory_order_relaxed);
+        
+        key        = entry.key.load(std::memory_order_relaxed);
+        suppressed = entry.suppressed_count.exchange(0, std::memory_order_relaxed);
+        
+        if(suppressed > 0)
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/*---------------------------------------------------------*\
+| Function: HasSuppressed                                    |
+|                                                           |
+| Description: Tells whether any suppressed errors are      |
+|              still waiting to be reported                 |
+|                                                           |
+| Returns: true if a count is waiting                       |
+\*---------------------------------------------------------*/
+bool AMBXLogLimiter::HasSuppressed()
+{
+    for(unsigned int slot = 0; slot < AMBX_LOG_LIMITER_KEYS; slot++)
+    {
+        if(keys[slot].suppressed_count.load(std::memory_order_relaxed) != 0)
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
@@ -0,0 +1,146 @@
+/*---------------------------------------------------------*\
+| AMBXLog.h                                                 |
+|                                                           |
+|   Logging for Philips amBX Gaming lights                  |
+|                                                           |
+|   Wraps OpenRGB's LogManager with a compile-time level.   |
+|   Messages less severe than AMBX_LOG_LEVEL are compiled   |
+|   out, their arguments are still type checked but never   |
+|   evaluated or formatted. Errors that repeat on every     |
+|   packet go through an AMBXLogLimiter so an outage logs   |
+|   one line per interval and error instead of one per      |
+|   packet.                                                 |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include "LogManager.h"
+#include <atomic>
+#include <climits>
+
+/*-----------------------------------------------------*\
+| Levels, numbered like LogManager's                    |
+\*-----------------------------------------------------*/
+#define AMBX_LOG_LEVEL_ERROR                1
+#define AMBX_LOG_LEVEL_WARNING              2
+#define AMBX_LOG_LEVEL_INFO                 3
+#define AMBX_LOG_LEVEL_VERBOSE              4
+#define AMBX_LOG_LEVEL_DEBUG                5
+#define AMBX_LOG_LEVEL_TRACE                6
+
+/*-----------------------------------------------------*\
+| Release builds keep info and above unless the build   |
+| defines AMBX_LOG_LEVEL. qmake marks release builds    |
+| with QT_NO_DEBUG rather than NDEBUG, so either counts. |
+\*-----------------------------------------------------*/
+#ifndef AMBX_LOG_LEVEL
+#if defined(QT_NO_DEBUG) || defined(NDEBUG)
+#define AMBX_LOG_LEVEL                      AMBX_LOG_LEVEL_INFO
+#else
+#define AMBX_LOG_LEVEL                      AMBX_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+/*-----------------------------------------------------*\
+| Shortest time between two logs of the same repeated   |
+| error, in ms                                          |
+\*-----------------------------------------------------*/
+#define AMBX_LOG_REPEAT_INTERVAL            1000
+
+/*-----------------------------------------------------*\
+| Distinct errors each limiter tracks at once. Beyond   |
+| that the least recently logged one is forgotten,      |
+| along with its suppressed count.                      |
+\*-----------------------------------------------------*/
+#define AMBX_LOG_LIMITER_KEYS               4
+#define AMBX_LOG_LIMITER_NO_KEY             INT_MIN
+
+#define AMBX_LOG_DISCARD(log, ...)          do { if(false) { log(__VA_ARGS__); } } while(0)
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_ERROR
+#define AMBX_LOG_ERROR(...)                 LOG_ERROR(__VA_ARGS__)
+#else
+#define AMBX_LOG_ERROR(...)                 AMBX_LOG_DISCARD(LOG_ERROR, __VA_ARGS__)
+#endif
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_WARNING
+#define AMBX_LOG_WARNING(...)               LOG_WARNING(__VA_ARGS__)
+#else
+#define AMBX_LOG_WARNING(...)               AMBX_LOG_DISCARD(LOG_WARNING, __VA_ARGS__)
+#endif
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_INFO
+#define AMBX_LOG_INFO(...)                  LOG_INFO(__VA_ARGS__)
+#else
+#define AMBX_LOG_INFO(...)                  AMBX_LOG_DISCARD(LOG_INFO, __VA_ARGS__)
+#endif
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_VERBOSE
+#define AMBX_LOG_VERBOSE(...)               LOG_VERBOSE(__VA_ARGS__)
+#else
+#define AMBX_LOG_VERBOSE(...)               AMBX_LOG_DISCARD(LOG_VERBOSE, __VA_ARGS__)
+#endif
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_DEBUG
+#define AMBX_LOG_DEBUG(...)                 LOG_DEBUG(__VA_ARGS__)
+#else
+#define AMBX_LOG_DEBUG(...)                 AMBX_LOG_DISCARD(LOG_DEBUG, __VA_ARGS__)
+#endif
+
+#if AMBX_LOG_LEVEL >= AMBX_LOG_LEVEL_TRACE
+#define AMBX_LOG_TRACE(...)                 LOG_TRACE(__VA_ARGS__)
+#else
+#define AMBX_LOG_TRACE(...)                 AMBX_LOG_DISCARD(LOG_TRACE, __VA_ARGS__)
+#endif
+
+/*-----------------------------------------------------*\
+| Suppresses an error that repeats with the same key    |
+| within AMBX_LOG_REPEAT_INTERVAL of the last time that |
+| key was logged. Each key is tracked on its own, so    |
+| two alternating errors do not defeat it. The next     |
+| error logged with a key reports how many were         |
+| suppressed before it, and TakeSuppressed lets a timer |
+| report counts whose errors have stopped. Lock-free,   |
+| so it can be shared by the writer and the libusb      |
+| event thread.                                         |
+\*-----------------------------------------------------*/
+class AMBXLogLimiter
+{
+public:
+    AMBXLogLimiter();
+    
+    bool                    ShouldLog(int key, unsigned int& suppressed);
+    bool                    TakeSuppressed(int& key, unsigned int& suppressed);
+    bool                    HasSuppressed();
+
+private:
+    struct ambx_log_key
+    {
+        std::atomic<int>            key;
+        std::atomic<long long>      last_log_ms;
+        std::atomic<unsigned int>   suppressed_count;
+    };
+    
+    ambx_log_key                    keys[AMBX_LOG_LIMITER_KEYS];
+    
+    static long long        NowMs();
+};
+
+#define AMBX_LOG_ERROR_LIMITED(limiter, key, ...)                                       \
+    do                                                                                  \
+    {                                                                                   \
+        unsigned int ambx_log_suppressed;                                               \
+                                                                                        \
+        if((limiter).ShouldLog(key, ambx_log_suppressed))                               \
+        {                                                                               \
+            if(ambx_log_suppressed > 0)                                                 \
+            {                                                                           \
+                AMBX_LOG_ERROR("%u identical errors suppressed", ambx_log_suppressed);  \
+            }                                                                           \
+                                                                                        \
+            AMBX_LOG_ERROR(__VA_ARGS__);                                                \
+        }                                                                               \
+    } while(0)
@@ -0,0 +1,374 @@
+/*---------------------------------------------------------*\
+| AMBXStats.cpp                                             |
+|                                                           |
+|   Transfer statistics for Philips amBX Gaming lights      |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXStats.h"
+#include <algorithm>
+
+AMBXLatencyHistogram::AMBXLatencyHistogram()
+{
+    count    = 0;
+    total_us = 0;
+    max_us   = 0;
+    
+    for(unsigned int bucket = 0; bucket < AMBX_STATS_BUCKETS; bucket++)
+    {
+        buckets[bucket] = 0;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: BucketIndex                                      |
+|                                                           |
+| Description: Finds the histogram bucket of a value. Below |
+|              AMBX_STATS_SUB_BUCKETS a value is its own    |
+|              bucket. Above, the highest set bit picks the |
+|              power of two and the bits just below it pick |
+|              the linear bucket within it.                 |
+|                                                           |
+| Parameters:                                               |
+|   value_us - Value in microseconds                        |
+|                                                           |
+| Returns: The bucket index                                 |
+\*---------------------------------------------------------*/
+unsigned int AMBXLatencyHistogram::BucketIndex(unsigned int value_us)
+{
+    if(value_us < AMBX_STATS_SUB_BUCKETS)
+    {
+        return value_us;
+    }
+    
+    unsigned int top_bit = 31;
+    
+    while((value_us & (1u << top_bit)) == 0)
+    {
+        top_bit--;
+    }
+    
+    unsigned int shift = top_bit - AMBX_STATS_SUB_BUCKET_BITS;
+    
+    return ((shift + 1) << AMBX_STATS_SUB_BUCKET_BITS) + ((value_us >> shift) & (AMBX_STATS_SUB_BUCKETS - 1));
+}
+
+/*---------------------------------------------------------*\
+| Function: BucketUpperEdge                                  |
+|                                                           |
+| Description: Returns the largest value that falls in a    |
+|              bucket                                       |
+|                                                           |
+| Parameters:                                               |
+|   bucket - The bucket index                               |
+|                                                           |
+| Returns: The value in microseconds                        |
+\*---------------------------------------------------------*/
+unsigned int AMBXLatencyHistogram::BucketUpperEdge(unsigned int bucket)
+{
+    if(bucket < AMBX_STATS_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    
+    unsigned int shift    = (bucket >> AMBX_STATS_SUB_BUCKET_BITS) - 1;
+    unsigned int mantissa = (bucket & (AMBX_STATS_SUB_BUCKETS - 1)) | AMBX_STATS_SUB_BUCKETS;
+    
+    // The top bucket's edge is the largest 32 bit value, computed without overflowing
+    return (mantissa << shift) + ((1u << shift) - 1);
+}
+
+void AMBXLatencyHistogram::Record(unsigned int value_us)
+{
+    buckets[BucketIndex(value_us)].fetch_add(1, std::memory_order_relaxed);
+    total_us.fetch_add(value_us, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    
+    unsigned int max = max_us.load(std::memory_order_relaxed);
+    
+    while(value_us > max && !max_us.compare_exchange_weak(max, value_us, std::memory_order_relaxed))
+    {
+    }
+}
+
+unsigned long long AMBXLatencyHistogram::GetCount()
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+unsigned int AMBXLatencyHistogram::GetMean()
+{
+    unsigned long long samples = count.load(std::memory_order_relaxed);
+    
+    if(samples == 0)
+    {
+        return 0;
+    }
+    
+    return (unsigned int)(total_us.load(std::memory_order_relaxed) / samples);
+}
+
+unsigned int AMBXLatencyHistogram::GetMax()
+{
+    return max_us.load(std::memory_order_relaxed);
+}
+
+/*---------------------------------------------------------*\
+| Function: GetPercentile                                    |
+|                                                           |
+| Description: Walks the buckets to the one holding the     |
+|              given fraction of samples. Samples recorded  |
+|              during the walk may or may not be included.  |
+|                                                           |
+| Parameters:                                               |
+|   percentile - Fraction of samples, 0.0 to 1.0            |
+|                                                           |
+| Returns: The upper edge of the bucket, at most the        |
+|          largest value recorded                           |
+\*---------------------------------------------------------*/
+unsigned int AMBXLatencyHistogram::GetPercentile(double percentile)
+{
+    unsigned long long samples = count.load(std::memory_order_relaxed);
+    
+    if(samples == 0)
+    {
+        return 0;
+    }
+    
+    unsigned long long target = std::max(1ULL, (unsigned long long)(percentile * samples + 0.5));
+    unsigned long long seen   = 0;
+    unsigned int       max    = max_us.load(std::memory_order_relaxed);
+    
+    for(unsigned int bucket = 0; bucket < AMBX_STATS_BUCKETS; bucket++)
+    {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+        
+        if(seen >= target)
+        {
+            return std::min(BucketUpperEdge(bucket), max);
+        }
+    }
+    
+    return max;
+}
+
+AMBXStats::AMBXStats()
+{
+    frames            = 0;
+    packets_submitted = 0;
+    packets_completed = 0;
+    packets_skipped   = 0;
+    packets_dropped   = 0;
+    bytes_submitted   = 0;
+    bytes_completed   = 0;
+    invalidations     = 0;
+    
+    for(unsigned int code = 0; code < AMBX_STATS_ERROR_CODES; code++)
+    {
+        submit_errors[code] = 0;
+    }
+    
+    for(unsigned int status = 0; status < AMBX_STATS_TRANSFER_STATUSES; status++)
+    {
+        transfer_statuses[status] = 0;
+    }
+    
+    long long now_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    
+    for(stats_rate* rate : { &frame_rate, &packet_rate })
+    {
+        rate->window_start_us = now_us;
+        rate->window_events   = 0;
+        rate->rate            = 0;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: CountRate                                        |
+|                                                           |
+| Description: Counts an event towards a rate, publishing   |
+|              the rate once its window is a second old     |
+|                                                           |
+| Parameters:                                               |
+|   rate - The rate to count towards                        |
+|   now  - Time of the event                                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXStats::CountRate(stats_rate& rate, std::chrono::steady_clock::time_point now)
+{
+    rate.window_events.fetch_add(1, std::memory_order_relaxed);
+    
+    long long now_us  = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    long long start   = rate.window_start_us.load(std::memory_order_relaxed);
+    long long elapsed = now_us - start;
+    
+    if(elapsed < 1000000)
+    {
+        return;
+    }
+    
+    // Only the thread that moves the window on publishes its rate
+    if(rate.window_start_us.compare_exchange_strong(start, now_us, std::memory_order_relaxed))
+    {
+        unsigned long long events = rate.window_events.exchange(0, std::memory_order_relaxed);
+        
+        rate.rate.store((unsigned int)((events * 1000000ULL) / elapsed), std::memory_order_relaxed);
+    }
+}
+
+void AMBXStats::FrameSent(std::chrono::steady_clock::time_point now)
+{
+    frames.fetch_add(1, std::memory_order_relaxed);
+    CountRate(frame_rate, now);
+}
+
+void AMBXStats::PacketSubmitted(unsigned int size, std::chrono::steady_clock::time_point now)
+{
+    packets_submitted.fetch_add(1, std::memory_order_relaxed);
+    bytes_submitted.fetch_add(size, std::memory_order_relaxed);
+    CountRate(packet_rate, now);
+}
+
+/*---------------------------------------------------------*\
+| Function: PacketCompleted                                  |
+|                                                           |
+| Description: Counts a completed transfer by status. Only  |
+|              transfers that reached the device add to the |
+|              bytes completed and the latency histogram.   |
+|                                                           |
+| Parameters:                                               |
+|   size    - Size of the packet in bytes                   |
+|   status  - libusb status of the transfer                 |
+|   elapsed - Time from submit to completion                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXStats::PacketCompleted(unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration elapsed)
+{
+    packets_completed.fetch_add(1, std::memory_order_relaxed);
+    
+    if((unsigned int)status < AMBX_STATS_TRANSFER_STATUSES)
+    {
+        transfer_statuses[status].fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    if(status != LIBUSB_TRANSFER_COMPLETED)
+    {
+        return;
+    }
+    
+    long long latency_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    
+    bytes_completed.fetch_add(size, std::memory_order_relaxed);
+    latency.Record((unsigned int)std::min(std::max(latency_us, 0LL), (long long)0xFFFFFFFF));
+}
+
+void AMBXStats::PacketsSkipped(unsigned int count)
+{
+    packets_skipped.fetch_add(count, std::memory_order_relaxed);
+}
+
+void AMBXStats::PacketDropped()
+{
+    packets_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AMBXStats::SubmitFailed(int error)
+{
+    submit_errors[ErrorCodeIndex(error)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void AMBXStats::LightInvalidated()
+{
+    invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long AMBXStats::GetFrames()
+{
+    return frames.load(std::memory_order_relaxed);
+}
+
+unsigned long long AMBXStats::GetPacketsSubmitted()
+{
+    return packets_submitted.load(std::memory_order_relaxed);
+}
+
+unsigned long long AMBXStats::GetPacketsSkipped()
+{
+    return packets_skipped.load(std::memory_order_relaxed);
+}
+
+unsigned int AMBXStats::GetPacketRate()
+{
+    return packet_rate.rate.load(std::memory_order_relaxed);
+}
+
+/*---------------------------------------------------------*\
+| Function: GetSnapshot                                      |
+|                                                           |
+| Description: Reads every counter and summarizes the       |
+|              latency histogram. Counters are read one by  |
+|              one, so a snapshot taken under load can be   |
+|              off by the packets in flight.                |
+|                                                           |
+| Returns: The current statistics                           |
+\*---------------------------------------------------------*/
+AMBXStatsSnapshot AMBXStats::GetSnapshot()
+{
+    AMBXStatsSnapshot snapshot;
+    
+    snapshot.frames             = frames.load(std::memory_order_relaxed);
+    snapshot.frames_per_second  = frame_rate.rate.load(std::memory_order_relaxed);
+    snapshot.packets_submitted  = packets_submitted.load(std::memory_order_relaxed);
+    snapshot.packets_completed  = packets_completed.load(std::memory_order_relaxed);
+    snapshot.packets_skipped    = packets_skipped.load(std::memory_order_relaxed);
+    snapshot.packets_dropped    = packets_dropped.load(std::memory_order_relaxed);
+    snapshot.packets_per_second = packet_rate.rate.load(std::memory_order_relaxed);
+    snapshot.bytes_submitted    = bytes_submitted.load(std::memory_order_relaxed);
+    snapshot.bytes_completed    = bytes_completed.load(std::memory_order_relaxed);
+    snapshot.invalidations      = invalidations.load(std::memory_order_relaxed);
+    
+    for(unsigned int code = 0; code < AMBX_STATS_ERROR_CODES; code++)
+    {
+        snapshot.submit_errors[code] = submit_errors[code].load(std::memory_order_relaxed);
+    }
+    
+    for(unsigned int status = 0; status < AMBX_STATS_TRANSFER_STATUSES; status++)
+    {
+        snapshot.transfer_statuses[status] = transfer_statuses[status].load(std::memory_order_relaxed);
+    }
+    
+    snapshot.latency_count   = latency.GetCount();
+    snapshot.latency_mean_us = latency.GetMean();
+    snapshot.latency_p50_us  = latency.GetPercentile(0.50);
+    snapshot.latency_p90_us  = latency.GetPercentile(0.90);
+    snapshot.latency_p99_us  = latency.GetPercentile(0.99);
+    snapshot.latency_p999_us = latency.GetPercentile(0.999);
+    snapshot.latency_max_us  = latency.GetMax();
+    
+    return snapshot;
+}
+
+/*---------------------------------------------------------*\
+| Function: ErrorCodeIndex                                   |
+|                                                           |
+| Description: Maps a libusb error code to its slot in      |
+|              submit_errors                                |
+|                                                           |
+| Parameters:                                               |
+|   error - A libusb_error value                            |
+|                                                           |
+| Returns: The slot index                                   |
+\*---------------------------------------------------------*/
+int AMBXStats::ErrorCodeIndex(int error)
+{
+    if(error <= 0 && error > -(AMBX_STATS_ERROR_CODES - 1))
+    {
+        return -error;
+    }
+    
+    return AMBX_STATS_ERROR_CODES - 1;
+}
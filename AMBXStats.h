@@ -0,0 +1,169 @@
+/*---------------------------------------------------------*\
+| AMBXStats.h                                               |
+|                                                           |
+|   Transfer statistics for Philips amBX Gaming lights      |
+|                                                           |
+|   Counts frames, packets, bytes, errors by libusb code    |
+|   and lights invalidated by failed packets, and keeps a   |
+|   log-linear histogram of submit to completion latency.   |
+|   Everything is a relaxed atomic updated without locks,   |
+|   so it stays on in normal use. Counters only ever grow,  |
+|   readers diff snapshots to look at an interval.          |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#include "dependencies/libusb-1.0.27/include/libusb.h"
+#else
+#include <libusb.h>
+#endif
+
+/*-----------------------------------------------------*\
+| Latency histogram                                     |
+|                                                       |
+| Values in microseconds are bucketed by power of two,  |
+| each power split into AMBX_STATS_SUB_BUCKETS linear   |
+| buckets, so every bucket is within about 6% of the    |
+| values in it from 16 us up to the full 32 bit range.  |
+| Values below 16 us get a bucket each.                 |
+\*-----------------------------------------------------*/
+#define AMBX_STATS_SUB_BUCKET_BITS          4
+#define AMBX_STATS_SUB_BUCKETS              (1 << AMBX_STATS_SUB_BUCKET_BITS)
+#define AMBX_STATS_BUCKETS                  ((32 - AMBX_STATS_SUB_BUCKET_BITS + 1) * AMBX_STATS_SUB_BUCKETS)
+
+/*-----------------------------------------------------*\
+| Submit errors are counted by libusb error code. Index |
+| i holds code -i for LIBUSB_SUCCESS down to            |
+| LIBUSB_ERROR_NOT_SUPPORTED, the last index holds      |
+| LIBUSB_ERROR_OTHER and anything unknown.              |
+\*-----------------------------------------------------*/
+#define AMBX_STATS_ERROR_CODES              14
+
+/*-----------------------------------------------------*\
+| Completions are counted by libusb_transfer_status,    |
+| LIBUSB_TRANSFER_COMPLETED to LIBUSB_TRANSFER_OVERFLOW |
+\*-----------------------------------------------------*/
+#define AMBX_STATS_TRANSFER_STATUSES        7
+
+typedef struct
+{
+    unsigned long long      frames;
+    unsigned int            frames_per_second;
+    
+    /*-------------------------------------------------*\
+    | Packets are USB transfers, which hold several     |
+    | SET_COLOR commands on a multi-command device      |
+    \*-------------------------------------------------*/
+    unsigned long long      packets_submitted;
+    unsigned long long      packets_completed;
+    unsigned long long      packets_skipped;
+    unsigned long long      packets_dropped;
+    unsigned int            packets_per_second;
+    unsigned long long      bytes_submitted;
+    unsigned long long      bytes_completed;
+    
+    /*-------------------------------------------------*\
+    | Lights whose last sent color was forgotten after  |
+    | a failed packet, so their next update goes out    |
+    | even if unchanged. Nothing is resubmitted.        |
+    \*-------------------------------------------------*/
+    unsigned long long      invalidations;
+    
+    unsigned long long      submit_errors[AMBX_STATS_ERROR_CODES];
+    unsigned long long      transfer_statuses[AMBX_STATS_TRANSFER_STATUSES];
+    
+    /*-------------------------------------------------*\
+    | Latency of completed transfers. Percentiles are   |
+    | the upper edge of their bucket.                   |
+    \*-------------------------------------------------*/
+    unsigned long long      latency_count;
+    unsigned int            latency_mean_us;
+    unsigned int            latency_p50_us;
+    unsigned int            latency_p90_us;
+    unsigned int            latency_p99_us;
+    unsigned int            latency_p999_us;
+    unsigned int            latency_max_us;
+} AMBXStatsSnapshot;
+
+class AMBXLatencyHistogram
+{
+public:
+    AMBXLatencyHistogram();
+    
+    void                    Record(unsigned int value_us);
+    
+    unsigned long long      GetCount();
+    unsigned int            GetMean();
+    unsigned int            GetMax();
+    unsigned int            GetPercentile(double percentile);
+    
+    static unsigned int     BucketIndex(unsigned int value_us);
+    static unsigned int     BucketUpperEdge(unsigned int bucket);
+
+private:
+    std::atomic<unsigned long long> count;
+    std::atomic<unsigned long long> total_us;
+    std::atomic<unsigned int>       max_us;
+    std::atomic<unsigned long long> buckets[AMBX_STATS_BUCKETS];
+};
+
+class AMBXStats
+{
+public:
+    AMBXStats();
+    
+    void                    FrameSent(std::chrono::steady_clock::time_point now);
+    void                    PacketSubmitted(unsigned int size, std::chrono::steady_clock::time_point now);
+    void                    PacketCompleted(unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration elapsed);
+    void                    PacketsSkipped(unsigned int count);
+    void                    PacketDropped();
+    void                    SubmitFailed(int error);
+    void                    LightInvalidated();
+    
+    unsigned long long      GetFrames();
+    unsigned long long      GetPacketsSubmitted();
+    unsigned long long      GetPacketsSkipped();
+    unsigned int            GetPacketRate();
+    
+    AMBXStatsSnapshot       GetSnapshot();
+    
+    static int              ErrorCodeIndex(int error);
+
+private:
+    /*-----------------------------------------------------*\
+    | Events per second over windows of at least a second.  |
+    | Whichever thread first sees a window end publishes    |
+    | its rate and starts the next one.                     |
+    \*-----------------------------------------------------*/
+    typedef struct
+    {
+        std::atomic<long long>      window_start_us;
+        std::atomic<unsigned int>   window_events;
+        std::atomic<unsigned int>   rate;
+    } stats_rate;
+    
+    std::atomic<unsigned long long> frames;
+    std::atomic<unsigned long long> packets_submitted;
+    std::atomic<unsigned long long> packets_completed;
+    std::atomic<unsigned long long> packets_skipped;
+    std::atomic<unsigned long long> packets_dropped;
+    std::atomic<unsigned long long> bytes_submitted;
+    std::atomic<unsigned long long> bytes_completed;
+    std::atomic<unsigned long long> invalidations;
+    std::atomic<unsigned long long> submit_errors[AMBX_STATS_ERROR_CODES];
+    std::atomic<unsigned long long> transfer_statuses[AMBX_STATS_TRANSFER_STATUSES];
+    
+    stats_rate                      frame_rate;
+    stats_rate                      packet_rate;
+    
+    AMBXLatencyHistogram            latency;
+    
+    static void             CountRate(stats_rate& rate, std::chrono::steady_clock::time_point now);
+};
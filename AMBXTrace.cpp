@@ -0,0 +1,453 @@
+/*---------------------------------------------------------*\
+| AMBXTrace.cpp                                             |
+|                                                           |
+|   Timeline tracing for Philips amBX Gaming lights         |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXTrace.h"
+#include "AMBXLog.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static_assert((AMBX_TRACE_BUFFER_EVENTS & (AMBX_TRACE_BUFFER_EVENTS - 1)) == 0, "AMBX_TRACE_BUFFER_EVENTS must be a power of two");
+
+typedef struct
+{
+    const char*             name;
+    const char*             arg_name;
+    long long               start_ns;
+    long long               duration_ns;
+    long long               arg_value;
+} ambx_trace_event;
+
+/*-----------------------------------------------------*\
+| Single producer, single consumer event buffer. The    |
+| owning thread appends, Flush drains under the         |
+| registry lock. A buffer that is not in use is         |
+| retired, one whose thread exited is handed to the     |
+| next new thread once it has been drained.             |
+\*-----------------------------------------------------*/
+typedef struct
+{
+    ambx_trace_event                events[AMBX_TRACE_BUFFER_EVENTS];
+    std::atomic<unsigned int>       write_position;
+    std::atomic<unsigned int>       read_position;
+    std::atomic<unsigned int>       dropped;
+    std::atomic<bool>               retired;
+    unsigned int                    thread_id;
+    char                            thread_name[AMBX_TRACE_THREAD_NAME];
+    bool                            thread_name_written;
+} ambx_trace_buffer;
+
+typedef struct
+{
+    std::mutex                                      mutex;
+    std::vector<std::unique_ptr<ambx_trace_buffer>> buffers;
+    std::string                                     path;
+    bool                                            header_written;
+    long long                                       start_ns;
+    unsigned int                                    next_thread_id;
+    unsigned int                                    named_threads;
+} ambx_trace_registry;
+
+/*-----------------------------------------------------*\
+| Per-thread state. The name is kept here so threads    |
+| can name themselves before tracing is enabled without |
+| allocating a buffer. Named threads are counted so     |
+| enabling tracing can allocate a buffer for each.      |
+\*-----------------------------------------------------*/
+struct ambx_trace_thread
+{
+    ambx_trace_buffer*      buffer = nullptr;
+    char                    name[AMBX_TRACE_THREAD_NAME] = {};
+    bool                    named = false;
+    
+    ~ambx_trace_thread();
+};
+
+static thread_local ambx_trace_thread trace_thread;
+
+std::atomic<bool> AMBXTrace::enabled(false);
+std::atomic<long long> AMBXTrace::next_flush_ns(0);
+
+/*---------------------------------------------------------*\
+| Function: GetRegistry                                      |
+|                                                           |
+| Description: Returns the list of thread buffers. It is    |
+|              never destroyed, so threads still running at |
+|              exit can keep recording into it.             |
+|                                                           |
+| Returns: The process-wide registry                        |
+\*---------------------------------------------------------*/
+static ambx_trace_registry& GetRegistry()
+{
+    static ambx_trace_registry* registry = new ambx_trace_registry{ {}, {}, "", false, 0, 1, 0 };
+    
+    return *registry;
+}
+
+ambx_trace_thread::~ambx_trace_thread()
+{
+    if(buffer != nullptr)
+    {
+        buffer->retired.store(true, std::memory_order_release);
+    }
+    
+    if(named)
+    {
+        ambx_trace_registry&        registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        
+        registry.named_threads--;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: ReserveBuffers                                   |
+|                                                           |
+| Description: Allocates retired buffers until the registry |
+|              holds at least count of them in total. Must  |
+|              be called with the registry lock held.       |
+|                                                           |
+| Parameters:                                               |
+|   registry - The registry, locked                         |
+|   count    - Number of buffers wanted                     |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+static void ReserveBuffers(ambx_trace_registry& registry, size_t count)
+{
+    while(registry.buffers.size() < count)
+    {
+        ambx_trace_buffer* buffer = new ambx_trace_buffer;
+        
+        buffer->write_position      = 0;
+        buffer->read_position       = 0;
+        buffer->dropped             = 0;
+        buffer->retired             = true;
+        buffer->thread_id           = 0;
+        buffer->thread_name[0]      = '\0';
+        buffer->thread_name_written = true;
+        
+        registry.buffers.push_back(std::unique_ptr<ambx_trace_buffer>(buffer));
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: GetThreadBuffer                                  |
+|                                                           |
+| Description: Returns the calling thread's buffer, taking  |
+|              a drained retired buffer, and only           |
+|              allocating one if every buffer is in use     |
+|                                                           |
+| Returns: The buffer                                       |
+\*---------------------------------------------------------*/
+static ambx_trace_buffer* GetThreadBuffer()
+{
+    if(trace_thread.buffer != nullptr)
+    {
+        return trace_thread.buffer;
+    }
+    
+    ambx_trace_registry&        registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    
+    ambx_trace_buffer* buffer = nullptr;
+    
+    for(std::unique_ptr<ambx_trace_buffer>& candidate : registry.buffers)
+    {
+        if(candidate->retired.load(std::memory_order_acquire) &&
+           candidate->write_position.load(std::memory_order_relaxed) == candidate->read_position.load(std::memory_order_relaxed))
+        {
+            buffer = candidate.get();
+            break;
+        }
+    }
+    
+    if(buffer == nullptr)
+    {
+        ReserveBuffers(registry, registry.buffers.size() + 1);
+        
+        buffer = registry.buffers.back().get();
+    }
+    
+    buffer->retired             = false;
+    buffer->thread_id           = registry.next_thread_id++;
+    buffer->thread_name_written = false;
+    memcpy(buffer->thread_name, trace_thread.name, AMBX_TRACE_THREAD_NAME);
+    
+    trace_thread.buffer = buffer;
+    
+    return buffer;
+}
+
+/*---------------------------------------------------------*\
+| Function: Enable                                           |
+|                                                           |
+| Description: Starts recording events. Flushes append to   |
+|              the given file, which is started over when   |
+|              the path changes.                            |
+|                                                           |
+| Parameters:                                               |
+|   path - File to write the trace to                       |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTrace::Enable(const std::string& path)
+{
+    ambx_trace_registry&        registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    
+    if(registry.path != path)
+    {
+        registry.path           = path;
+        registry.header_written = false;
+    }
+    
+    if(registry.start_ns == 0)
+    {
+        registry.start_ns = Now();
+    }
+    
+    // Threads take these on their first event instead of allocating then
+    ReserveBuffers(registry, registry.named_threads + AMBX_TRACE_SPARE_BUFFERS);
+    
+    next_flush_ns.store(Now() + (AMBX_TRACE_FLUSH_INTERVAL * 1000000LL), std::memory_order_relaxed);
+    enabled.store(true, std::memory_order_relaxed);
+    
+    AMBX_LOG_INFO("amBX tracing enabled, writing to %s", path.c_str());
+}
+
+void AMBXTrace::Disable()
+{
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+long long AMBXTrace::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*---------------------------------------------------------*\
+| Function: SetThreadName                                    |
+|                                                           |
+| Description: Names the calling thread in the trace and    |
+|              registers it. Threads that record events     |
+|              should call it when they start, so that      |
+|              their buffer is set up there rather than on  |
+|              their first event. Safe to call whether or   |
+|              not tracing is enabled.                      |
+|                                                           |
+| Parameters:                                               |
+|   name - The thread name, truncated if too long           |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTrace::SetThreadName(const char* name)
+{
+    snprintf(trace_thread.name, AMBX_TRACE_THREAD_NAME, "%s", name);
+    
+    if(!trace_thread.named)
+    {
+        ambx_trace_registry&        registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        
+        registry.named_threads++;
+        trace_thread.named = true;
+    }
+    
+    if(trace_thread.buffer != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+        
+        memcpy(trace_thread.buffer->thread_name, trace_thread.name, AMBX_TRACE_THREAD_NAME);
+        trace_thread.buffer->thread_name_written = false;
+    }
+    else if(IsEnabled())
+    {
+        // Take the buffer now, GetThreadBuffer copies the name into it
+        GetThreadBuffer();
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: Complete                                         |
+|                                                           |
+| Description: Appends a finished span to the calling       |
+|              thread's buffer, or counts it as dropped if  |
+|              the buffer is full                           |
+|                                                           |
+| Parameters:                                               |
+|   name        - Event name                                |
+|   start_ns    - Start time from Now()                     |
+|   duration_ns - Length of the span                        |
+|   arg_name    - Name of the optional argument, or nullptr |
+|   arg_value   - Value of the optional argument            |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTrace::Complete(const char* name, long long start_ns, long long duration_ns, const char* arg_name, long long arg_value)
+{
+    ambx_trace_buffer* buffer   = GetThreadBuffer();
+    unsigned int       position = buffer->write_position.load(std::memory_order_relaxed);
+    
+    if(position - buffer->read_position.load(std::memory_order_acquire) >= AMBX_TRACE_BUFFER_EVENTS)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    ambx_trace_event& event = buffer->events[position & (AMBX_TRACE_BUFFER_EVENTS - 1)];
+    
+    event.name        = name;
+    event.arg_name    = arg_name;
+    event.start_ns    = start_ns;
+    event.duration_ns = duration_ns;
+    event.arg_value   = arg_value;
+    
+    buffer->write_position.store(position + 1, std::memory_order_release);
+}
+
+/*---------------------------------------------------------*\
+| Function: Flush                                            |
+|                                                           |
+| Description: Drains every thread's buffer into the trace  |
+|              file. The file uses Chrome's JSON array      |
+|              format, whose closing bracket is optional,   |
+|              so each flush appends to what is there.      |
+|                                                           |
+| Returns: true if the file was written                     |
+\*---------------------------------------------------------*/
+bool AMBXTrace::Flush()
+{
+    ambx_trace_registry&        registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    
+    if(registry.path.empty())
+    {
+        return false;
+    }
+    
+    FILE* file = fopen(registry.path.c_str(), registry.header_written ? "a" : "w");
+    
+    if(file == nullptr)
+    {
+        AMBX_LOG_ERROR("Failed to open amBX trace file %s", registry.path.c_str());
+        return false;
+    }
+    
+    if(!registry.header_written)
+    {
+        fprintf(file, "[\n");
+        registry.header_written = true;
+    }
+    
+    unsigned long long written = 0;
+    
+    for(std::unique_ptr<ambx_trace_buffer>& buffer : registry.buffers)
+    {
+        unsigned int read_position  = buffer->read_position.load(std::memory_order_relaxed);
+        unsigned int write_position = buffer->write_position.load(std::memory_order_acquire);
+        unsigned int dropped        = buffer->dropped.exchange(0, std::memory_order_relaxed);
+        
+        if(read_position == write_position && dropped == 0 && buffer->thread_name_written)
+        {
+            continue;
+        }
+        
+        if(!buffer->thread_name_written && buffer->thread_name[0] != '\0')
+        {
+            fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", buffer->thread_id);
+            
+            for(const char* character = buffer->thread_name; *character != '\0'; character++)
+            {
+                if(*character == '"' || *character == '\\')
+                {
+                    fputc('\\', file);
+                }
+                
+                fputc(*character, file);
+            }
+            
+            fprintf(file, "\"}},\n");
+        }
+        
+        buffer->thread_name_written = true;
+        
+        for(; read_position != write_position; read_position++)
+        {
+            ambx_trace_event& event = buffer->events[read_position & (AMBX_TRACE_BUFFER_EVENTS - 1)];
+            
+            fprintf(file, "{\"name\":\"%s\",\"cat\":\"amBX\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+                    event.name,
+                    (event.start_ns - registry.start_ns) / 1000.0,
+                    event.duration_ns / 1000.0,
+                    buffer->thread_id);
+            
+            if(event.arg_name != nullptr)
+            {
+                fprintf(file, ",\"args\":{\"%s\":%lld}", event.arg_name, event.arg_value);
+            }
+            
+            fprintf(file, "},\n");
+            written++;
+        }
+        
+        buffer->read_position.store(write_position, std::memory_order_release);
+        
+        if(dropped > 0)
+        {
+            fprintf(file, "{\"name\":\"Events dropped\",\"cat\":\"amBX\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"count\":%u}},\n",
+                    (Now() - registry.start_ns) / 1000.0,
+                    buffer->thread_id,
+                    dropped);
+        }
+    }
+    
+    fclose(file);
+    
+    AMBX_LOG_DEBUG("Wrote %llu amBX trace events to %s", written, registry.path.c_str());
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: FlushIfDue                                       |
+|                                                           |
+| Description: Flushes the trace if tracing is enabled and  |
+|              AMBX_TRACE_FLUSH_INTERVAL has passed since   |
+|              the last periodic flush. Called from every   |
+|              writer thread, only one of them takes each   |
+|              flush.                                       |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTrace::FlushIfDue()
+{
+    if(!IsEnabled())
+    {
+        return;
+    }
+    
+    long long now = Now();
+    long long due = next_flush_ns.load(std::memory_order_relaxed);
+    
+    if(now < due)
+    {
+        return;
+    }
+    
+    if(!next_flush_ns.compare_exchange_strong(due, now + (AMBX_TRACE_FLUSH_INTERVAL * 1000000LL), std::memory_order_relaxed))
+    {
+        return;
+    }
+    
+    Flush();
+}
@@ -0,0 +1,117 @@
+/*---------------------------------------------------------*\
+| AMBXTrace.h                                               |
+|                                                           |
+|   Timeline tracing for Philips amBX Gaming lights         |
+|                                                           |
+|   Records scoped events around the update path into a     |
+|   buffer owned by each thread, without locks, and writes  |
+|   them out as Chrome trace JSON on demand. The file opens |
+|   in chrome://tracing and ui.perfetto.dev. While tracing  |
+|   is disabled a scope costs one relaxed load and branch.  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+/*-----------------------------------------------------*\
+| Events each thread can hold between flushes, a power  |
+| of two. Events recorded into a full buffer are        |
+| dropped and counted.                                  |
+\*-----------------------------------------------------*/
+#define AMBX_TRACE_BUFFER_EVENTS            8192
+
+/*-----------------------------------------------------*\
+| Longest thread name kept, including the terminator    |
+\*-----------------------------------------------------*/
+#define AMBX_TRACE_THREAD_NAME              48
+
+/*-----------------------------------------------------*\
+| Buffers are allocated when a named thread registers   |
+| or tracing is enabled, never on a thread's first      |
+| event. Enabling also sets aside this many for threads |
+| that record events without naming themselves.         |
+\*-----------------------------------------------------*/
+#define AMBX_TRACE_SPARE_BUFFERS            2
+
+/*-----------------------------------------------------*\
+| Writer threads flush the trace this often (ms) while  |
+| it is enabled, well before a busy thread's buffer     |
+| fills up                                              |
+\*-----------------------------------------------------*/
+#define AMBX_TRACE_FLUSH_INTERVAL           1000
+
+class AMBXTrace
+{
+public:
+    static void             Enable(const std::string& path);
+    static void             Disable();
+    static bool             Flush();
+    static void             FlushIfDue();
+    
+    static bool             IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    
+    static void             SetThreadName(const char* name);
+    
+    static long long        Now();
+    
+    /*-----------------------------------------------------*\
+    | Records a finished span on the calling thread. name   |
+    | and arg_name must be string literals, they are kept   |
+    | by pointer until the next flush.                      |
+    \*-----------------------------------------------------*/
+    static void             Complete(const char* name, long long start_ns, long long duration_ns, const char* arg_name = nullptr, long long arg_value = 0);
+
+private:
+    static std::atomic<bool>        enabled;
+    static std::atomic<long long>   next_flush_ns;
+};
+
+/*-----------------------------------------------------*\
+| Records the lifetime of a scope as one span, if       |
+| tracing was enabled when the scope was entered. The   |
+| flag is read once and kept, so the constructor and    |
+| destructor test the same constant and a disabled      |
+| scope folds down to a single branch.                  |
+\*-----------------------------------------------------*/
+class AMBXTraceScope
+{
+public:
+    AMBXTraceScope(const char* name, const char* arg_name = nullptr, long long arg_value = 0)
+        : active(AMBXTrace::IsEnabled()), name(name), arg_name(arg_name), arg_value(arg_value), start_ns(0)
+    {
+        if(active)
+        {
+            start_ns = AMBXTrace::Now();
+        }
+    }
+    
+    ~AMBXTraceScope()
+    {
+        if(active)
+        {
+            AMBXTrace::Complete(name, start_ns, AMBXTrace::Now() - start_ns, arg_name, arg_value);
+        }
+    }
+    
+    AMBXTraceScope(const AMBXTraceScope&) = delete;
+    AMBXTraceScope& operator=(const AMBXTraceScope&) = delete;
+
+private:
+    const bool              active;
+    const char*             name;
+    const char*             arg_name;
+    long long               arg_value;
+    long long               start_ns;
+};
+
+#define AMBX_TRACE_CONCAT_INNER(a, b)       a##b
+#define AMBX_TRACE_CONCAT(a, b)             AMBX_TRACE_CONCAT_INNER(a, b)
+#define AMBX_TRACE_SCOPE(...)               AMBXTraceScope AMBX_TRACE_CONCAT(ambx_trace_scope_, __LINE__)(__VA_ARGS__)
@@ -0,0 +1,120 @@
+/*---------------------------------------------------------*\
+| AMBXTransport.cpp                                         |
+|                                                           |
+|   Transport interface for Philips amBX Gaming lights      |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXTransport.h"
+#include <vector>
+
+AMBXTransportReaper::AMBXTransportReaper()
+{
+    reaper_thread_run = true;
+    reaper_thread     = std::thread(&AMBXTransportReaper::ReaperThreadFunction, this);
+}
+
+AMBXTransportReaper::~AMBXTransportReaper()
+{
+    {
+        std::lock_guard<std::mutex> lock(reaper_mutex);
+        reaper_thread_run = false;
+    }
+    
+    reaper_cv.notify_one();
+    reaper_thread.join();
+}
+
+/*---------------------------------------------------------*\
+| Function: Get                                              |
+|                                                           |
+| Description: Returns the reaper, starting it on first use |
+|                                                           |
+| Returns: The process-wide reaper                          |
+\*---------------------------------------------------------*/
+AMBXTransportReaper& AMBXTransportReaper::Get()
+{
+    static AMBXTransportReaper reaper;
+    
+    return reaper;
+}
+
+/*---------------------------------------------------------*\
+| Function: Reap                                             |
+|                                                           |
+| Description: Takes ownership of a transport whose         |
+|              controller is gone and closes and deletes it |
+|              in the background. Its callbacks must have   |
+|              been cleared.                                |
+|                                                           |
+| Parameters:                                               |
+|   transport - The transport to close                      |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTransportReaper::Reap(AMBXTransport* transport)
+{
+    {
+        std::lock_guard<std::mutex> lock(reaper_mutex);
+        reaper_queue.push_back(transport);
+    }
+    
+    reaper_cv.notify_one();
+}
+
+/*---------------------------------------------------------*\
+| Function: ReaperThreadFunction                             |
+|                                                           |
+| Description: Closes queued transports, each on its own    |
+|              thread when several are waiting, and keeps   |
+|              going until the queue is empty on exit       |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXTransportReaper::ReaperThreadFunction()
+{
+    std::unique_lock<std::mutex> lock(reaper_mutex);
+    
+    while(true)
+    {
+        reaper_cv.wait(lock, [this]
+        {
+            return !reaper_queue.empty() || !reaper_thread_run;
+        });
+        
+        if(reaper_queue.empty())
+        {
+            break;
+        }
+        
+        std::deque<AMBXTransport*> batch;
+        batch.swap(reaper_queue);
+        
+        lock.unlock();
+        
+        std::vector<std::thread> closers;
+        
+        for(std::size_t transport_idx = 1; transport_idx < batch.size(); transport_idx++)
+        {
+            AMBXTransport* transport = batch[transport_idx];
+            
+            closers.push_back(std::thread([transport]
+            {
+                transport->Close();
+                delete transport;
+            }));
+        }
+        
+        batch[0]->Close();
+        delete batch[0];
+        
+        for(std::thread& closer : closers)
+        {
+            closer.join();
+        }
+        
+        lock.lock();
+    }
+}
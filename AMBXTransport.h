@@ -0,0 +1,238 @@
+/*---------------------------------------------------------*\
+| AMBXTransport.h                                           |
+|                                                           |
+|   Transport interface for Philips amBX Gaming lights      |
+|                                                           |
+|   AMBXController speaks the amBX packet protocol and      |
+|   hands finished packets to a transport. Writes are       |
+|   asynchronous: Write returns once the packet is queued   |
+|   and the completion callback reports the outcome with    |
+|   a libusb transfer status, whichever transport is used.  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include "dependencies/libusb-1.0.27/include/libusb.h"
+#else
+#include <libusb.h>
+#endif
+
+/*-----------------------------------------------------*\
+| Time in milliseconds a write may wait for room in the |
+| transport's queue, and a transfer may take to finish. |
+| Transports may use less, down to the minimum, when    |
+| the device polls its endpoint faster.                 |
+\*-----------------------------------------------------*/
+#define AMBX_TRANSFER_TIMEOUT               100
+#define AMBX_TRANSFER_TIMEOUT_MIN           20
+
+/*-----------------------------------------------------*\
+| Time in milliseconds Close waits for outstanding      |
+| writes before cancelling them                         |
+\*-----------------------------------------------------*/
+#define AMBX_SHUTDOWN_TIMEOUT               20
+
+/*-----------------------------------------------------*\
+| Endpoint description                                  |
+|                                                       |
+| What the device advertises for its interrupt OUT      |
+| endpoint: the address, wMaxPacketSize and the polling |
+| interval from bInterval in microseconds. Writes may   |
+| be longer than wMaxPacketSize, they are sent as       |
+| several transactions.                                 |
+\*-----------------------------------------------------*/
+typedef struct
+{
+    unsigned char           address;
+    unsigned int            max_packet_size;
+    unsigned int            interval_us;
+} AMBXEndpointInfo;
+
+/*-----------------------------------------------------*\
+| Completion callback                                   |
+|                                                       |
+| Called once per successful Write, from the            |
+| transport's own thread, with the packet as written,   |
+| the libusb transfer status and the time from submit   |
+| to completion. Clearing a callback waits for a call   |
+| in progress, so its target may be freed afterwards.   |
+\*-----------------------------------------------------*/
+typedef void (*AMBXTransportCallback)(void* callback_arg, const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency);
+
+/*-----------------------------------------------------*\
+| Connection callback                                   |
+|                                                       |
+| Called when an opened device goes away or comes back. |
+| While disconnected, Write fails fast with             |
+| LIBUSB_ERROR_NO_DEVICE.                               |
+\*-----------------------------------------------------*/
+typedef void (*AMBXTransportConnectionCallback)(void* callback_arg, bool connected);
+
+class AMBXTransport
+{
+public:
+    AMBXTransport()
+    {
+        callback                = nullptr;
+        callback_arg            = nullptr;
+        connection_callback     = nullptr;
+        connection_callback_arg = nullptr;
+        halted                  = false;
+    }
+    
+    virtual ~AMBXTransport() {}
+    
+    /*-----------------------------------------------------*\
+    | Open the device, returns true if it is ready for      |
+    | writes. Close waits for outstanding writes, cancelling|
+    | any that do not finish in time.                       |
+    \*-----------------------------------------------------*/
+    virtual bool        Open()                                                                      = 0;
+    virtual void        Close()                                                                     = 0;
+    
+    /*-----------------------------------------------------*\
+    | Write queues a packet to the OUT endpoint and returns |
+    | LIBUSB_SUCCESS or a libusb error code. Read blocks    |
+    | on the IN endpoint and returns the number of bytes    |
+    | read or a libusb error code.                          |
+    \*-----------------------------------------------------*/
+    virtual int         Write(const unsigned char* packet, unsigned int size)                       = 0;
+    virtual int         Read(unsigned char* data, unsigned int size, unsigned int timeout_ms)       = 0;
+    
+    /*-----------------------------------------------------*\
+    | GetSerial may be called before Open, and reads the    |
+    | serial without claiming the device if it can          |
+    \*-----------------------------------------------------*/
+    virtual std::string GetLocation()                                                               = 0;
+    virtual std::string GetSerial()                                                                 = 0;
+    
+    /*-----------------------------------------------------*\
+    | Valid once Open has succeeded                         |
+    \*-----------------------------------------------------*/
+    virtual AMBXEndpointInfo GetOutEndpoint()                                                       = 0;
+    
+    void SetCompletionCallback(AMBXTransportCallback new_callback, void* new_callback_arg)
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex);
+        
+        callback     = new_callback;
+        callback_arg = new_callback_arg;
+    }
+    
+    void SetConnectionCallback(AMBXTransportConnectionCallback new_callback, void* new_callback_arg)
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex);
+        
+        connection_callback     = new_callback;
+        connection_callback_arg = new_callback_arg;
+    }
+
+protected:
+    /*-----------------------------------------------------*\
+    | A stalled transfer leaves the OUT endpoint halted and |
+    | every later transfer fails until the halt is cleared, |
+    | which cannot be done from the completion. Complete    |
+    | marks the endpoint halted and each Write calls        |
+    | RecoverHalt under its device lock before submitting,  |
+    | which has ClearHalt clear it on the device.           |
+    \*-----------------------------------------------------*/
+    virtual int         ClearHalt()                                                                 = 0;
+    
+    int RecoverHalt()
+    {
+        if(!halted.exchange(false, std::memory_order_acquire))
+        {
+            return LIBUSB_SUCCESS;
+        }
+        
+        int result = ClearHalt();
+        
+        // Still halted, try again with the next write
+        if(result != LIBUSB_SUCCESS)
+        {
+            MarkHalted();
+        }
+        
+        return result;
+    }
+    
+    void MarkHalted()
+    {
+        halted.store(true, std::memory_order_release);
+    }
+    
+    void Complete(const unsigned char* packet, unsigned int size, libusb_transfer_status status, std::chrono::steady_clock::duration latency)
+    {
+        if(status == LIBUSB_TRANSFER_STALL)
+        {
+            MarkHalted();
+        }
+        
+        std::lock_guard<std::mutex> lock(callback_mutex);
+        
+        if(callback != nullptr)
+        {
+            callback(callback_arg, packet, size, status, latency);
+        }
+    }
+    
+    void ConnectionChanged(bool connected)
+    {
+        std::lock_guard<std::mutex> lock(callback_mutex);
+        
+        if(connection_callback != nullptr)
+        {
+            connection_callback(connection_callback_arg, connected);
+        }
+    }
+
+private:
+    std::mutex                      callback_mutex;
+    AMBXTransportCallback           callback;
+    void*                           callback_arg;
+    AMBXTransportConnectionCallback connection_callback;
+    void*                           connection_callback_arg;
+    std::atomic<bool>               halted;
+};
+
+/*-----------------------------------------------------*\
+| Transport reaper                                      |
+|                                                       |
+| Closes and deletes transports handed over by their    |
+| controllers, so waiting for the last packets to go    |
+| out happens off OpenRGB's teardown path. Transports   |
+| handed over together are closed in parallel. Anything |
+| still queued is closed before the program exits.      |
+\*-----------------------------------------------------*/
+class AMBXTransportReaper
+{
+public:
+    static AMBXTransportReaper& Get();
+
+    ~AMBXTransportReaper();
+
+    void                    Reap(AMBXTransport* transport);
+
+private:
+    AMBXTransportReaper();
+
+    std::thread                     reaper_thread;
+    bool                            reaper_thread_run;
+    std::deque<AMBXTransport*>      reaper_queue;
+    std::mutex                      reaper_mutex;
+    std::condition_variable         reaper_cv;
+
+    void                    ReaperThreadFunction();
+};
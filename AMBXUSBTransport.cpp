@@ -0,0 +1,1222 @@
+/*---------------------------------------------------------*\
+| AMBXUSBTransport.cpp                                      |
+|                                                           |
+|   libusb transport for Philips amBX Gaming lights         |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXUSBTransport.h"
+#include "AMBXController.h"
+#include "AMBXTrace.h"
+#include "AMBXLog.h"
+#include <algorithm>
+#include <cstring>
+
+std::mutex                      AMBXUSBContext::instance_mutex;
+std::weak_ptr<AMBXUSBContext>   AMBXUSBContext::instance;
+
+AMBXUSBContext::AMBXUSBContext(libusb_context* context)
+{
+    usb_context = context;
+    hotplug_registered = false;
+    hotplug_handle = 0;
+    
+    /*-----------------------------------------------------*\
+    | Devices already present are found by the detector,    |
+    | so only changes from here on are reported             |
+    \*-----------------------------------------------------*/
+    if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+    {
+        int result = libusb_hotplug_register_callback(usb_context,
+                                                      LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                                      LIBUSB_HOTPLUG_NO_FLAGS,
+                                                      AMBX_VID,
+                                                      AMBX_PID,
+                                                      LIBUSB_HOTPLUG_MATCH_ANY,
+                                                      HotplugCallback,
+                                                      this,
+                                                      &hotplug_handle);
+        
+        hotplug_registered = (result == LIBUSB_SUCCESS);
+        
+        if(!hotplug_registered)
+        {
+            AMBX_LOG_WARNING("Failed to register amBX hotplug callback: %s", libusb_error_name(result));
+        }
+    }
+    else
+    {
+        AMBX_LOG_INFO("libusb has no hotplug support here, reconnected amBX devices need a rescan");
+    }
+    
+    if(hotplug_registered)
+    {
+        hotplug_thread_run = true;
+        hotplug_thread     = std::thread(&AMBXUSBContext::HotplugThreadFunction, this);
+    }
+    
+    event_thread_run = true;
+    event_thread     = std::thread(&AMBXUSBContext::EventThreadFunction, this);
+}
+
+AMBXUSBContext::~AMBXUSBContext()
+{
+    if(hotplug_registered)
+    {
+        libusb_hotplug_deregister_callback(usb_context, hotplug_handle);
+        
+        {
+            std::lock_guard<std::mutex> lock(hotplug_mutex);
+            hotplug_thread_run = false;
+        }
+        
+        hotplug_cv.notify_one();
+        hotplug_thread.join();
+        
+        for(ambx_hotplug_event& event : hotplug_events)
+        {
+            libusb_unref_device(event.device);
+        }
+    }
+    
+    event_thread_run = false;
+    libusb_interrupt_event_handler(usb_context);
+    event_thread.join();
+    
+    libusb_exit(usb_context);
+}
+
+/*---------------------------------------------------------*\
+| Function: Get                                              |
+|                                                           |
+| Description: Returns the shared libusb context, creating  |
+|              it if nobody holds it                        |
+|                                                           |
+| Returns: The shared context, or nullptr if libusb could   |
+|          not be initialized                               |
+\*---------------------------------------------------------*/
+std::shared_ptr<AMBXUSBContext> AMBXUSBContext::Get()
+{
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    
+    std::shared_ptr<AMBXUSBContext> shared = instance.lock();
+    
+    if(shared == nullptr)
+    {
+        libusb_context* context = nullptr;
+        
+        int libusb_result = libusb_init(&context);
+        if(libusb_result != LIBUSB_SUCCESS)
+        {
+            AMBX_LOG_ERROR("Failed to initialize libusb: %s", libusb_error_name(libusb_result));
+            return nullptr;
+        }
+        
+        shared   = std::shared_ptr<AMBXUSBContext>(new AMBXUSBContext(context));
+        instance = shared;
+    }
+    
+    return shared;
+}
+
+libusb_context* AMBXUSBContext::GetContext()
+{
+    return usb_context;
+}
+
+/*---------------------------------------------------------*\
+| Function: EventThreadFunction                              |
+|                                                           |
+| Description: Handles libusb events for every amBX device, |
+|              which runs the transfer completion callbacks |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::EventThreadFunction()
+{
+    AMBXTrace::SetThreadName("amBX USB events");
+    
+    while(event_thread_run)
+    {
+        struct timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = AMBX_TRANSFER_TIMEOUT * 1000;
+        
+        libusb_handle_events_timeout_completed(usb_context, &timeout, nullptr);
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: RegisterTransport                                |
+|                                                           |
+| Description: Adds an opened transport to those that are   |
+|              parked and rebound on hotplug events         |
+|                                                           |
+| Parameters:                                               |
+|   transport - The transport to register                   |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::RegisterTransport(AMBXUSBTransport* transport)
+{
+    std::lock_guard<std::mutex> lock(transports_mutex);
+    
+    transports.push_back(transport);
+}
+
+/*---------------------------------------------------------*\
+| Function: UnregisterTransport                              |
+|                                                           |
+| Description: Removes a transport, waiting for a hotplug   |
+|              event that is using it to finish             |
+|                                                           |
+| Parameters:                                               |
+|   transport - The transport to unregister                 |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::UnregisterTransport(AMBXUSBTransport* transport)
+{
+    std::lock_guard<std::mutex> lock(transports_mutex);
+    
+    transports.erase(std::remove(transports.begin(), transports.end(), transport), transports.end());
+}
+
+/*---------------------------------------------------------*\
+| Function: HotplugCallback                                  |
+|                                                           |
+| Description: Queues an amBX arrival or removal for the    |
+|              hotplug thread. Runs on the event thread, so |
+|              it must not wait on transfers.               |
+|                                                           |
+| Returns: 0 to stay registered                             |
+\*---------------------------------------------------------*/
+int LIBUSB_CALL AMBXUSBContext::HotplugCallback(libusb_context* /*context*/, libusb_device* device, libusb_hotplug_event event, void* user_data)
+{
+    AMBXUSBContext*    usb_context = static_cast<AMBXUSBContext*>(user_data);
+    ambx_hotplug_event queued;
+    
+    queued.device  = libusb_ref_device(device);
+    queued.arrived = (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+    
+    {
+        std::lock_guard<std::mutex> lock(usb_context->hotplug_mutex);
+        usb_context->hotplug_events.push_back(queued);
+    }
+    
+    usb_context->hotplug_cv.notify_one();
+    
+    return 0;
+}
+
+/*---------------------------------------------------------*\
+| Function: HotplugThreadFunction                            |
+|                                                           |
+| Description: Handles queued hotplug events in order       |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::HotplugThreadFunction()
+{
+    std::unique_lock<std::mutex> lock(hotplug_mutex);
+    
+    while(true)
+    {
+        hotplug_cv.wait(lock, [this]
+        {
+            return !hotplug_events.empty() || !hotplug_thread_run;
+        });
+        
+        if(!hotplug_thread_run)
+        {
+            break;
+        }
+        
+        ambx_hotplug_event event = hotplug_events.front();
+        hotplug_events.pop_front();
+        
+        lock.unlock();
+        
+        if(event.arrived)
+        {
+            DeviceArrived(event.device);
+        }
+        else
+        {
+            DeviceLeft(event.device);
+        }
+        
+        libusb_unref_device(event.device);
+        
+        lock.lock();
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: DeviceArrived                                    |
+|                                                           |
+| Description: Hands an arriving amBX device to a parked    |
+|              transport, preferring the one with the same  |
+|              serial number, then the one that was last on |
+|              the same port. A transport whose serial is   |
+|              known and differs is never picked.           |
+|                                                           |
+| Parameters:                                               |
+|   device - The device that arrived                        |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::DeviceArrived(libusb_device* device)
+{
+    std::lock_guard<std::mutex> lock(transports_mutex);
+    
+    std::string       new_port_path = AMBXUSBTransport::GetPortPath(device);
+    std::string       new_serial    = AMBXUSBTransport::ReadSerial(device);
+    AMBXUSBTransport* by_serial     = nullptr;
+    AMBXUSBTransport* by_port       = nullptr;
+    AMBXUSBTransport* any           = nullptr;
+    
+    for(AMBXUSBTransport* transport : transports)
+    {
+        if(transport->attached)
+        {
+            continue;
+        }
+        
+        if(!new_serial.empty() && !transport->serial.empty())
+        {
+            if(transport->serial == new_serial && by_serial == nullptr)
+            {
+                by_serial = transport;
+            }
+            
+            continue;
+        }
+        
+        if(transport->port_path == new_port_path && by_port == nullptr)
+        {
+            by_port = transport;
+        }
+        
+        if(any == nullptr)
+        {
+            any = transport;
+        }
+    }
+    
+    AMBXUSBTransport* parked = (by_serial != nullptr) ? by_serial : ((by_port != nullptr) ? by_port : any);
+    
+    if(parked == nullptr)
+    {
+        AMBX_LOG_INFO("New amBX device connected, rescan devices to add it");
+        return;
+    }
+    
+    parked->Attach(device);
+}
+
+/*---------------------------------------------------------*\
+| Function: DeviceLeft                                       |
+|                                                           |
+| Description: Parks the transport of a removed device      |
+|                                                           |
+| Parameters:                                               |
+|   device - The device that was removed                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBContext::DeviceLeft(libusb_device* device)
+{
+    std::lock_guard<std::mutex> lock(transports_mutex);
+    
+    for(AMBXUSBTransport* transport : transports)
+    {
+        if(transport->device == device)
+        {
+            transport->Detach();
+            break;
+        }
+    }
+}
+
+AMBXUSBTransport::AMBXUSBTransport(const char* path)
+{
+    device_path = (path != nullptr) ? path : "";
+    device = nullptr;
+    dev_handle = nullptr;
+    interface_claimed = false;
+    registered = false;
+    attached = false;
+    out_endpoint.address = AMBX_ENDPOINT_OUT;
+    out_endpoint.max_packet_size = AMBX_TRANSFER_BUFFER_SIZE;
+    out_endpoint.interval_us = AMBX_PACING_MIN_GAP;
+    in_endpoint = AMBX_ENDPOINT_IN;
+    transfer_timeout_ms = AMBX_TRANSFER_TIMEOUT;
+    
+    location = "USB amBX: ";
+    location += device_path;
+}
+
+AMBXUSBTransport::AMBXUSBTransport(std::shared_ptr<AMBXUSBContext> context_ptr, libusb_device* device_ptr)
+{
+    context = context_ptr;
+    device = libusb_ref_device(device_ptr);
+    device_path = GetBusAddress(device);
+    dev_handle = nullptr;
+    interface_claimed = false;
+    registered = false;
+    attached = false;
+    out_endpoint.address = AMBX_ENDPOINT_OUT;
+    out_endpoint.max_packet_size = AMBX_TRANSFER_BUFFER_SIZE;
+    out_endpoint.interval_us = AMBX_PACING_MIN_GAP;
+    in_endpoint = AMBX_ENDPOINT_IN;
+    transfer_timeout_ms = AMBX_TRANSFER_TIMEOUT;
+    
+    char device_id[32];
+    sprintf(device_id, "Bus %d Addr %d", libusb_get_bus_number(device), libusb_get_device_address(device));
+    location = std::string("USB amBX: ") + device_id;
+}
+
+AMBXUSBTransport::~AMBXUSBTransport()
+{
+    Close();
+    
+    if(device != nullptr)
+    {
+        libusb_unref_device(device);
+        device = nullptr;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: Open                                             |
+|                                                           |
+| Description: Opens the amBX device handed over by the     |
+|              detector, or the first one found, claims its |
+|              interface and starts the transfer pipeline   |
+|                                                           |
+| Returns: true if the device is ready for writes           |
+\*---------------------------------------------------------*/
+bool AMBXUSBTransport::Open()
+{
+    if(context == nullptr)
+    {
+        context = AMBXUSBContext::Get();
+        
+        if(context == nullptr)
+        {
+            return false;
+        }
+    }
+    
+    if(device == nullptr)
+    {
+        device = FindDevice();
+        
+        if(device == nullptr)
+        {
+            return false;
+        }
+    }
+    
+    if(!OpenDevice())
+    {
+        return false;
+    }
+    
+    // Allocate the transfer pool, completions run on the shared event thread
+    if(!StartTransferPipeline())
+    {
+        AMBX_LOG_ERROR("Failed to start AMBX transfer pipeline");
+        
+        // Release the device so a later attempt can claim it again
+        CloseDevice();
+        return false;
+    }
+    
+    attached = true;
+    
+    // Park and rebind this transport when the device is unplugged and comes back
+    context->RegisterTransport(this);
+    registered = true;
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: FindDevice                                       |
+|                                                           |
+| Description: Finds the amBX device at the path given to   |
+|              the constructor, either "bus-address" as     |
+|              used by the detector or a "bus-port.port"    |
+|              port path. An empty path takes the first     |
+|              amBX device on the bus.                      |
+|                                                           |
+| Returns: A referenced device, or nullptr if none is found |
+\*---------------------------------------------------------*/
+libusb_device* AMBXUSBTransport::FindDevice()
+{
+    libusb_device*  found = nullptr;
+    libusb_device*  port_match = nullptr;
+    libusb_device** device_list;
+    ssize_t device_count = libusb_get_device_list(context->GetContext(), &device_list);
+    
+    if(device_count < 0)
+    {
+        AMBX_LOG_ERROR("Failed to get USB device list: %s", libusb_error_name(static_cast<int>(device_count)));
+        return nullptr;
+    }
+    
+    // Find our device in the list
+    for(ssize_t i = 0; i < device_count; i++)
+    {
+        struct libusb_device_descriptor desc;
+        
+        if(libusb_get_device_descriptor(device_list[i], &desc) != LIBUSB_SUCCESS)
+        {
+            continue;
+        }
+        
+        if(desc.idVendor != AMBX_VID || desc.idProduct != AMBX_PID)
+        {
+            continue;
+        }
+        
+        if(device_path.empty() || device_path == GetBusAddress(device_list[i]))
+        {
+            found = device_list[i];
+            break;
+        }
+        
+        // A port path only counts if no device matches by address
+        if(port_match == nullptr && device_path == GetPortPath(device_list[i]))
+        {
+            port_match = device_list[i];
+        }
+    }
+    
+    if(found == nullptr)
+    {
+        found = port_match;
+    }
+    
+    if(found != nullptr)
+    {
+        libusb_ref_device(found);
+    }
+    else
+    {
+        AMBX_LOG_WARNING("No amBX device found at %s", device_path.c_str());
+    }
+    
+    libusb_free_device_list(device_list, 1);
+    
+    return found;
+}
+
+/*---------------------------------------------------------*\
+| Function: GetBusAddress                                    |
+|                                                           |
+| Description: Formats a device's bus number and address as |
+|              "bus-address"                                |
+|                                                           |
+| Returns: The formatted path                               |
+\*---------------------------------------------------------*/
+std::string AMBXUSBTransport::GetBusAddress(libusb_device* usb_device)
+{
+    char bus_address[16];
+    sprintf(bus_address, "%d-%d", libusb_get_bus_number(usb_device), libusb_get_device_address(usb_device));
+    
+    return bus_address;
+}
+
+/*---------------------------------------------------------*\
+| Function: GetPortPath                                      |
+|                                                           |
+| Description: Formats a device's bus number and the ports  |
+|              leading to it as "bus-port.port", which stays |
+|              the same across replugs into the same port   |
+|                                                           |
+| Returns: The formatted path, or an empty string if libusb |
+|          cannot report the ports                          |
+\*---------------------------------------------------------*/
+std::string AMBXUSBTransport::GetPortPath(libusb_device* usb_device)
+{
+    uint8_t ports[8];
+    int port_count = libusb_get_port_numbers(usb_device, ports, sizeof(ports));
+    
+    if(port_count <= 0)
+    {
+        return "";
+    }
+    
+    std::string port_path = std::to_string(libusb_get_bus_number(usb_device)) + "-";
+    
+    for(int port_idx = 0; port_idx < port_count; port_idx++)
+    {
+        if(port_idx > 0)
+        {
+            port_path += ".";
+        }
+        
+        port_path += std::to_string(ports[port_idx]);
+    }
+    
+    return port_path;
+}
+
+/*---------------------------------------------------------*\
+| Function: ReadSerial                                       |
+|                                                           |
+| Description: Briefly opens a device to read its serial    |
+|              number, without claiming it                  |
+|                                                           |
+| Parameters:                                               |
+|   usb_device - The device to read                         |
+|                                                           |
+| Returns: The serial number, empty if the device has none  |
+|          or could not be opened                           |
+\*---------------------------------------------------------*/
+std::string AMBXUSBTransport::ReadSerial(libusb_device* usb_device)
+{
+    struct libusb_device_descriptor desc;
+    
+    if(libusb_get_device_descriptor(usb_device, &desc) != LIBUSB_SUCCESS || desc.iSerialNumber == 0)
+    {
+        return "";
+    }
+    
+    libusb_device_handle* handle = nullptr;
+    
+    if(libusb_open(usb_device, &handle) != LIBUSB_SUCCESS)
+    {
+        return "";
+    }
+    
+    unsigned char serial_str[256];
+    int serial_result = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+                                                           serial_str, sizeof(serial_str));
+    
+    libusb_close(handle);
+    
+    if(serial_result <= 0)
+    {
+        return "";
+    }
+    
+    return std::string(reinterpret_cast<char*>(serial_str), serial_result);
+}
+
+/*---------------------------------------------------------*\
+| Function: OpenDevice                                       |
+|                                                           |
+| Description: Opens the device, claims its interface and   |
+|              reads its serial number                      |
+|                                                           |
+| Returns: true if the interface was claimed                |
+\*---------------------------------------------------------*/
+bool AMBXUSBTransport::OpenDevice()
+{
+    struct libusb_device_descriptor desc;
+    
+    if(libusb_get_device_descriptor(device, &desc) != LIBUSB_SUCCESS)
+    {
+        return false;
+    }
+    
+    // Get bus and address for identifying multiple devices
+    uint8_t bus = libusb_get_bus_number(device);
+    uint8_t address = libusb_get_device_address(device);
+    
+    char device_id[32];
+    sprintf(device_id, "Bus %d Addr %d", bus, address);
+    location = std::string("USB amBX: ") + device_id;
+    port_path = GetPortPath(device);
+    
+    // Try to open this device
+    int result = libusb_open(device, &dev_handle);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        AMBX_LOG_WARNING("Failed to open AMBX device: %s", libusb_error_name(result));
+        dev_handle = nullptr;
+        return false;
+    }
+    
+    // Try to detach the kernel driver if attached
+    if(libusb_kernel_driver_active(dev_handle, 0))
+    {
+        libusb_detach_kernel_driver(dev_handle, 0);
+    }
+    
+    // Set auto-detach for Windows compatibility
+    libusb_set_auto_detach_kernel_driver(dev_handle, 1);
+    
+    // Claim the interface - IMPORTANT: keep it claimed until destruction
+    result = libusb_claim_interface(dev_handle, 0);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        AMBX_LOG_ERROR("Failed to claim interface: %s", libusb_error_name(result));
+        libusb_close(dev_handle);
+        dev_handle = nullptr;
+        return false;
+    }
+    
+    interface_claimed = true;
+    
+    // Pace and size transfers by what the device advertises
+    ReadEndpoints();
+    
+    // Get string descriptor for serial number if available
+    if(desc.iSerialNumber != 0)
+    {
+        unsigned char serial_str[256];
+        int serial_result = libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber,
+                                                               serial_str, sizeof(serial_str));
+        if(serial_result > 0)
+        {
+            serial = std::string(reinterpret_cast<char*>(serial_str), serial_result);
+        }
+    }
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: Close                                            |
+|                                                           |
+| Description: Waits for queued packets to go out, then     |
+|              releases and closes the device               |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::Close()
+{
+    // Nothing rebinds the device once it is closed
+    if(registered)
+    {
+        context->UnregisterTransport(this);
+        registered = false;
+    }
+    
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    attached = false;
+    
+    StopTransferPipeline();
+    CloseDevice();
+}
+
+/*---------------------------------------------------------*\
+| Function: CloseDevice                                      |
+|                                                           |
+| Description: Releases the interface and closes the handle |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::CloseDevice()
+{
+    if(dev_handle != nullptr)
+    {
+        // Release the interface if claimed
+        if(interface_claimed)
+        {
+            libusb_release_interface(dev_handle, 0);
+            interface_claimed = false;
+        }
+        
+        // Close the device
+        libusb_close(dev_handle);
+        dev_handle = nullptr;
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: Attach                                           |
+|                                                           |
+| Description: Opens a device that was plugged back in and  |
+|              resumes writes to it. Called on the hotplug  |
+|              thread.                                      |
+|                                                           |
+| Parameters:                                               |
+|   new_device - The device that arrived                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::Attach(libusb_device* new_device)
+{
+    {
+        std::lock_guard<std::mutex> lock(device_mutex);
+        
+        if(device != nullptr)
+        {
+            libusb_unref_device(device);
+        }
+        
+        device = libusb_ref_device(new_device);
+        
+        if(!OpenDevice())
+        {
+            AMBX_LOG_WARNING("amBX device reconnected at %s but could not be opened", GetBusAddress(device).c_str());
+            return;
+        }
+        
+        attached = true;
+    }
+    
+    AMBX_LOG_INFO("amBX device reconnected at %s", location.c_str());
+    
+    ConnectionChanged(true);
+}
+
+/*---------------------------------------------------------*\
+| Function: Detach                                           |
+|                                                           |
+| Description: Parks the transport after its device was     |
+|              unplugged. Writes fail fast until the device |
+|              comes back. Called on the hotplug thread.    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::Detach()
+{
+    // Fail writes right away rather than after the device lock
+    attached = false;
+    
+    ConnectionChanged(false);
+    
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    DrainTransfers(transfer_timeout_ms);
+    CloseDevice();
+    
+    AMBX_LOG_INFO("amBX device at %s disconnected", location.c_str());
+}
+
+/*---------------------------------------------------------*\
+| The hotplug thread rewrites these when a replugged device |
+| is attached, so they are copied out under device_mutex    |
+\*---------------------------------------------------------*/
+std::string AMBXUSBTransport::GetLocation()
+{
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    return location;
+}
+
+std::string AMBXUSBTransport::GetSerial()
+{
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    // Not opened yet, as with lazy_open, so read it without claiming the device
+    if(serial.empty() && dev_handle == nullptr && device != nullptr)
+    {
+        serial = ReadSerial(device);
+    }
+    
+    return serial;
+}
+
+AMBXEndpointInfo AMBXUSBTransport::GetOutEndpoint()
+{
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    return out_endpoint;
+}
+
+/*---------------------------------------------------------*\
+| Function: ReadEndpoints                                    |
+|                                                           |
+| Description: Reads the interrupt endpoints of interface 0 |
+|              from the active configuration descriptor and |
+|              derives the transfer timeout from the OUT    |
+|              endpoint's polling interval. The protocol    |
+|              defaults are kept for anything not found.    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::ReadEndpoints()
+{
+    struct libusb_config_descriptor* config = nullptr;
+    
+    int result = libusb_get_active_config_descriptor(device, &config);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        AMBX_LOG_WARNING("Failed to read amBX configuration descriptor: %s", libusb_error_name(result));
+        return;
+    }
+    
+    int  speed     = libusb_get_device_speed(device);
+    bool found_in  = false;
+    bool found_out = false;
+    
+    if(config->bNumInterfaces > 0 && config->interface[0].num_altsetting > 0)
+    {
+        const struct libusb_interface_descriptor* interface_desc = &config->interface[0].altsetting[0];
+        
+        for(unsigned int endpoint_idx = 0; endpoint_idx < interface_desc->bNumEndpoints; endpoint_idx++)
+        {
+            const struct libusb_endpoint_descriptor* endpoint = &interface_desc->endpoint[endpoint_idx];
+            
+            if((endpoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_INTERRUPT)
+            {
+                continue;
+            }
+            
+            if((endpoint->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
+            {
+                // The first IN endpoint carries input, later ones PnP events
+                if(!found_in)
+                {
+                    in_endpoint = endpoint->bEndpointAddress;
+                    found_in    = true;
+                }
+                continue;
+            }
+            
+            if(found_out)
+            {
+                continue;
+            }
+            
+            /*---------------------------------------------*\
+            | bInterval counts 1 ms frames at low and full  |
+            | speed and 2^(bInterval-1) 125 us microframes  |
+            | at high speed                                 |
+            \*---------------------------------------------*/
+            unsigned int interval = std::max((unsigned int)endpoint->bInterval, 1u);
+            
+            if(speed >= LIBUSB_SPEED_HIGH)
+            {
+                interval = 125u << (std::min(interval, 16u) - 1);
+            }
+            else
+            {
+                interval = interval * 1000;
+            }
+            
+            out_endpoint.address         = endpoint->bEndpointAddress;
+            out_endpoint.max_packet_size = std::min((unsigned int)endpoint->wMaxPacketSize & 0x7FF, (unsigned int)AMBX_TRANSFER_BUFFER_SIZE);
+            out_endpoint.interval_us     = interval;
+            found_out                    = true;
+        }
+    }
+    
+    libusb_free_config_descriptor(config);
+    
+    // Leave room for a full pool of transfers queued ahead of this one
+    transfer_timeout_ms = (out_endpoint.interval_us * AMBX_TRANSFER_POOL_SIZE * 4) / 1000;
+    transfer_timeout_ms = std::max(std::min(transfer_timeout_ms, (unsigned int)AMBX_TRANSFER_TIMEOUT), (unsigned int)AMBX_TRANSFER_TIMEOUT_MIN);
+    
+    AMBX_LOG_INFO("amBX OUT endpoint 0x%02X: %u byte packets every %u us, %u ms timeout",
+                  out_endpoint.address, out_endpoint.max_packet_size, out_endpoint.interval_us, transfer_timeout_ms);
+}
+
+/*---------------------------------------------------------*\
+| Function: Write                                            |
+|                                                           |
+| Description: Queues a packet as an asynchronous interrupt |
+|              transfer to the OUT endpoint                 |
+|                                                           |
+| Parameters:                                               |
+|   packet - Byte array containing the packet data          |
+|   size   - Size of the packet in bytes                    |
+|                                                           |
+| Returns: LIBUSB_SUCCESS or a libusb error code            |
+\*---------------------------------------------------------*/
+int AMBXUSBTransport::Write(const unsigned char* packet, unsigned int size)
+{
+    if(!attached)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    if(!attached || dev_handle == nullptr || !interface_claimed)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    // A transfer longer than wMaxPacketSize goes out as several transactions, it only has to fit its buffer
+    if(size > AMBX_TRANSFER_BUFFER_SIZE)
+    {
+        return LIBUSB_ERROR_OVERFLOW;
+    }
+    
+    // A stalled transfer, such as a rejected multi-command probe, halted the endpoint
+    int result = RecoverHalt();
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        return result;
+    }
+    
+    libusb_transfer* transfer = AcquireTransfer();
+    
+    if(transfer == nullptr)
+    {
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+    
+    unsigned char* buffer = transfer->buffer;
+    std::size_t    index  = (buffer - transfer_buffers.data()) / AMBX_TRANSFER_BUFFER_SIZE;
+    memcpy(buffer, packet, size);
+    
+    libusb_fill_interrupt_transfer(transfer, dev_handle, out_endpoint.address, buffer, size,
+                                   TransferCallback, this, transfer_timeout_ms);
+    
+    transfer_submit_times[index] = std::chrono::steady_clock::now();
+    
+    result = libusb_submit_transfer(transfer);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        ReleaseTransfer(transfer);
+        
+        // The endpoint is halted, clear it before the next write
+        if(result == LIBUSB_ERROR_PIPE)
+        {
+            MarkHalted();
+        }
+    }
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: ClearHalt                                        |
+|                                                           |
+| Description: Clears a halt on the OUT endpoint so writes  |
+|              go through again. Called from Write with     |
+|              device_mutex held, on the writer thread, as  |
+|              libusb_clear_halt waits for the device and   |
+|              must not run on the event thread.            |
+|                                                           |
+| Returns: LIBUSB_SUCCESS or a libusb error code            |
+\*---------------------------------------------------------*/
+int AMBXUSBTransport::ClearHalt()
+{
+    int result = libusb_clear_halt(dev_handle, out_endpoint.address);
+    
+    if(result == LIBUSB_SUCCESS)
+    {
+        AMBX_LOG_DEBUG("Cleared halt on amBX endpoint 0x%02X at %s", out_endpoint.address, location.c_str());
+    }
+    else
+    {
+        AMBX_LOG_WARNING("Failed to clear halt on amBX endpoint 0x%02X at %s: %s", out_endpoint.address, location.c_str(), libusb_error_name(result));
+    }
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: Read                                             |
+|                                                           |
+| Description: Reads from the IN endpoint                   |
+|                                                           |
+| Parameters:                                               |
+|   data       - Buffer for the received data               |
+|   size       - Size of the buffer in bytes                |
+|   timeout_ms - Time to wait for data                      |
+|                                                           |
+| Returns: Number of bytes read or a libusb error code      |
+\*---------------------------------------------------------*/
+int AMBXUSBTransport::Read(unsigned char* data, unsigned int size, unsigned int timeout_ms)
+{
+    std::lock_guard<std::mutex> lock(device_mutex);
+    
+    if(!attached || dev_handle == nullptr || !interface_claimed)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    int actual_length = 0;
+    int result = libusb_interrupt_transfer(dev_handle, in_endpoint, data, size, &actual_length, timeout_ms);
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        return result;
+    }
+    
+    return actual_length;
+}
+
+/*---------------------------------------------------------*\
+| Function: StartTransferPipeline                            |
+|                                                           |
+| Description: Allocates the pool of interrupt transfers    |
+|                                                           |
+| Returns: true if the pipeline is ready for use            |
+\*---------------------------------------------------------*/
+bool AMBXUSBTransport::StartTransferPipeline()
+{
+    transfer_buffers.resize(AMBX_TRANSFER_POOL_SIZE * AMBX_TRANSFER_BUFFER_SIZE);
+    transfer_submit_times.resize(AMBX_TRANSFER_POOL_SIZE);
+    
+    // Releasing a transfer must never grow the free list, writes stay allocation free
+    transfer_pool.reserve(AMBX_TRANSFER_POOL_SIZE);
+    free_transfers.reserve(AMBX_TRANSFER_POOL_SIZE);
+    
+    for(unsigned int i = 0; i < AMBX_TRANSFER_POOL_SIZE; i++)
+    {
+        libusb_transfer* transfer = libusb_alloc_transfer(0);
+        
+        if(transfer == nullptr)
+        {
+            StopTransferPipeline();
+            return false;
+        }
+        
+        transfer->buffer = &transfer_buffers[i * AMBX_TRANSFER_BUFFER_SIZE];
+        
+        transfer_pool.push_back(transfer);
+        free_transfers.push_back(transfer);
+    }
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: StopTransferPipeline                             |
+|                                                           |
+| Description: Waits briefly for in-flight transfers, then  |
+|              frees the transfer pool once every transfer  |
+|              is back in it                                |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::StopTransferPipeline()
+{
+    DrainTransfers(AMBX_SHUTDOWN_TIMEOUT);
+    
+    for(libusb_transfer* transfer : transfer_pool)
+    {
+        libusb_free_transfer(transfer);
+    }
+    
+    transfer_pool.clear();
+    free_transfers.clear();
+    transfer_buffers.clear();
+    transfer_submit_times.clear();
+}
+
+/*---------------------------------------------------------*\
+| Function: DrainTransfers                                   |
+|                                                           |
+| Description: Waits for in-flight transfers to complete,   |
+|              cancelling any that outlive the timeout. A   |
+|              cancelled transfer still gets its callback,  |
+|              which touches this transport and the pool,   |
+|              so the wait for those has no bound.          |
+|                                                           |
+| Parameters:                                               |
+|   timeout_ms - Time to wait before cancelling             |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::DrainTransfers(unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(transfer_mutex);
+    
+    bool drained = transfer_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]
+    {
+        return free_transfers.size() == transfer_pool.size();
+    });
+    
+    if(!drained)
+    {
+        // Cancel whatever is still outstanding, completions will follow
+        for(libusb_transfer* transfer : transfer_pool)
+        {
+            if(std::find(free_transfers.begin(), free_transfers.end(), transfer) == free_transfers.end())
+            {
+                libusb_cancel_transfer(transfer);
+            }
+        }
+        
+        AMBX_LOG_DEBUG("Cancelled %u amBX transfers at %s", (unsigned int)(transfer_pool.size() - free_transfers.size()), location.c_str());
+        
+        transfer_cv.wait(lock, [this]
+        {
+            return free_transfers.size() == transfer_pool.size();
+        });
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: AcquireTransfer                                  |
+|                                                           |
+| Description: Takes a transfer from the free pool, waiting |
+|              up to the transfer timeout if all of them    |
+|              are in flight                                |
+|                                                           |
+| Returns: A free transfer, or nullptr on timeout           |
+\*---------------------------------------------------------*/
+libusb_transfer* AMBXUSBTransport::AcquireTransfer()
+{
+    std::unique_lock<std::mutex> lock(transfer_mutex);
+    
+    if(!transfer_cv.wait_for(lock, std::chrono::milliseconds(transfer_timeout_ms), [this]
+    {
+        return !free_transfers.empty();
+    }))
+    {
+        return nullptr;
+    }
+    
+    libusb_transfer* transfer = free_transfers.back();
+    free_transfers.pop_back();
+    
+    return transfer;
+}
+
+/*---------------------------------------------------------*\
+| Function: ReleaseTransfer                                  |
+|                                                           |
+| Description: Returns a transfer to the free pool          |
+|                                                           |
+| Parameters:                                               |
+|   transfer - Transfer that is no longer in flight         |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::ReleaseTransfer(libusb_transfer* transfer)
+{
+    {
+        std::lock_guard<std::mutex> lock(transfer_mutex);
+        free_transfers.push_back(transfer);
+    }
+    
+    transfer_cv.notify_all();
+}
+
+/*---------------------------------------------------------*\
+| Function: TransferComplete                                 |
+|                                                           |
+| Description: Handles completion of an interrupt transfer  |
+|              on the event thread                          |
+|                                                           |
+| Parameters:                                               |
+|   transfer - The completed transfer                       |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXUSBTransport::TransferComplete(libusb_transfer* transfer)
+{
+    std::size_t index = (transfer->buffer - transfer_buffers.data()) / AMBX_TRANSFER_BUFFER_SIZE;
+    
+    Complete(transfer->buffer, transfer->length, transfer->status, std::chrono::steady_clock::now() - transfer_submit_times[index]);
+    
+    ReleaseTransfer(transfer);
+}
+
+void LIBUSB_CALL AMBXUSBTransport::TransferCallback(libusb_transfer* transfer)
+{
+    static_cast<AMBXUSBTransport*>(transfer->user_data)->TransferComplete(transfer);
+}
@@ -0,0 +1,181 @@
+/*---------------------------------------------------------*\
+| AMBXUSBTransport.h                                        |
+|                                                           |
+|   libusb transport for Philips amBX Gaming lights         |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include "AMBXTransport.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*-----------------------------------------------------*\
+| AMBX Transfers                                        |
+|                                                       |
+| Packets are written asynchronously from a pool of     |
+| pre-allocated interrupt transfers. A sender only      |
+| blocks if every transfer in the pool is in flight.    |
+| Each transfer buffer holds one full-speed interrupt   |
+| packet (64 bytes). Transfers and buffers are only     |
+| allocated when the device is opened, so writes and    |
+| completions never allocate.                           |
+\*-----------------------------------------------------*/
+#define AMBX_TRANSFER_POOL_SIZE             8
+#define AMBX_TRANSFER_BUFFER_SIZE           64
+
+class AMBXUSBTransport;
+
+typedef struct
+{
+    libusb_device*          device;
+    bool                    arrived;
+} ambx_hotplug_event;
+
+/*-----------------------------------------------------*\
+| Shared libusb context                                 |
+|                                                       |
+| One context and one event thread serve every amBX     |
+| device. It is created on first use and lives for as   |
+| long as the detector or any transport holds it.       |
+|                                                       |
+| Where libusb supports hotplug, the context watches    |
+| for amBX devices coming and going. A removed device   |
+| parks its transport, and an arriving one is opened on |
+| the hotplug thread and handed to a parked transport,  |
+| preferring the one with the same serial number, then  |
+| the one last seen on the same port.                   |
+\*-----------------------------------------------------*/
+class AMBXUSBContext
+{
+public:
+    static std::shared_ptr<AMBXUSBContext> Get();
+
+    ~AMBXUSBContext();
+
+    libusb_context*         GetContext();
+
+    void                    RegisterTransport(AMBXUSBTransport* transport);
+    void                    UnregisterTransport(AMBXUSBTransport* transport);
+
+private:
+    AMBXUSBContext(libusb_context* context);
+
+    libusb_context*                 usb_context;
+    std::thread                     event_thread;
+    std::atomic<bool>               event_thread_run;
+
+    /*-----------------------------------------------------*\
+    | Hotplug                                               |
+    \*-----------------------------------------------------*/
+    bool                            hotplug_registered;
+    libusb_hotplug_callback_handle  hotplug_handle;
+    std::thread                     hotplug_thread;
+    bool                            hotplug_thread_run;
+    std::deque<ambx_hotplug_event>  hotplug_events;
+    std::mutex                      hotplug_mutex;
+    std::condition_variable         hotplug_cv;
+
+    std::vector<AMBXUSBTransport*>  transports;
+    std::mutex                      transports_mutex;
+
+    void                    EventThreadFunction();
+    void                    HotplugThreadFunction();
+    void                    DeviceArrived(libusb_device* device);
+    void                    DeviceLeft(libusb_device* device);
+
+    static int LIBUSB_CALL  HotplugCallback(libusb_context* context, libusb_device* device, libusb_hotplug_event event, void* user_data);
+
+    static std::mutex                       instance_mutex;
+    static std::weak_ptr<AMBXUSBContext>    instance;
+};
+
+class AMBXUSBTransport : public AMBXTransport
+{
+public:
+    AMBXUSBTransport(const char* path);
+    AMBXUSBTransport(std::shared_ptr<AMBXUSBContext> context_ptr, libusb_device* device_ptr);
+    ~AMBXUSBTransport();
+    
+    bool                    Open();
+    void                    Close();
+    
+    int                     Write(const unsigned char* packet, unsigned int size);
+    int                     Read(unsigned char* data, unsigned int size, unsigned int timeout_ms);
+    
+    std::string             GetLocation();
+    std::string             GetSerial();
+    AMBXEndpointInfo        GetOutEndpoint();
+
+private:
+    friend class AMBXUSBContext;
+
+    std::shared_ptr<AMBXUSBContext> context;
+    std::string                     device_path;
+    std::string                     port_path;
+    libusb_device*                  device;
+    libusb_device_handle*           dev_handle;
+    std::string                     location;
+    std::string                     serial;
+    bool                            interface_claimed;
+    bool                            registered;
+
+    /*-----------------------------------------------------*\
+    | Endpoints as advertised by the device, read when it   |
+    | is opened                                             |
+    \*-----------------------------------------------------*/
+    AMBXEndpointInfo                out_endpoint;
+    unsigned char                   in_endpoint;
+    unsigned int                    transfer_timeout_ms;
+
+    /*-----------------------------------------------------*\
+    | device_mutex keeps the device from being swapped out  |
+    | by the hotplug thread while a packet is submitted,    |
+    | and guards what is read from it when it is opened     |
+    \*-----------------------------------------------------*/
+    std::atomic<bool>               attached;
+    std::mutex                      device_mutex;
+    
+    /*-----------------------------------------------------*\
+    | Asynchronous transfer pipeline                        |
+    \*-----------------------------------------------------*/
+    std::vector<libusb_transfer*>   transfer_pool;
+    std::vector<libusb_transfer*>   free_transfers;
+    std::vector<unsigned char>      transfer_buffers;
+    std::vector<std::chrono::steady_clock::time_point> transfer_submit_times;
+    std::mutex                      transfer_mutex;
+    std::condition_variable         transfer_cv;
+    
+    int                     ClearHalt();
+    
+    void                    Attach(libusb_device* new_device);
+    void                    Detach();
+    void                    CloseDevice();
+
+    libusb_device*          FindDevice();
+    static std::string      GetBusAddress(libusb_device* usb_device);
+    static std::string      GetPortPath(libusb_device* usb_device);
+    static std::string      ReadSerial(libusb_device* usb_device);
+    bool                    OpenDevice();
+    void                    ReadEndpoints();
+    
+    bool                    StartTransferPipeline();
+    void                    StopTransferPipeline();
+    void                    DrainTransfers(unsigned int timeout_ms);
+    
+    libusb_transfer*        AcquireTransfer();
+    void                    ReleaseTransfer(libusb_transfer* transfer);
+    void                    TransferComplete(libusb_transfer* transfer);
+    
+    static void LIBUSB_CALL TransferCallback(libusb_transfer* transfer);
+};
@@ -8,7 +8,11 @@
 \*---------------------------------------------------------*/
 
 #include "RGBController_AMBX.h"
-#include "LogManager.h"
+#include "AMBXTrace.h"
+#include "AMBXLog.h"
+#include "hsv.h"
+#include <algorithm>
+#include <cmath>
 
 // Static counter for numbering multiple devices
 static int amBX_device_count = 0;
@@ -19,7 +23,7 @@ static int amBX_device_count = 0;
     @type USB
     @save :x:
     @direct :white_check_mark:
-    @effects :x:
+    @effects :white_check_mark:
     @detectors DetectAMBXControllers
     @comment The Philips amBX Gaming lights system includes left and right
     lights and a wall-washer bar with three zones.
@@ -51,11 +55,39 @@ RGBController_AMBX::RGBController_AMBX(AMBXController* controller_ptr)
 
     mode Direct;
     Direct.name         = "Direct";
-    Direct.value        = 0;
+    Direct.value        = AMBX_MODE_DIRECT;
     Direct.flags        = MODE_FLAG_HAS_PER_LED_COLOR;
     Direct.color_mode   = MODE_COLORS_PER_LED;
     modes.push_back(Direct);
     
+    /*-------------------------------------------------*\
+    | Effect modes are played by the device from timed  |
+    | color sequences, one packet per cycle             |
+    \*-------------------------------------------------*/
+    mode Breathing;
+    Breathing.name       = "Breathing";
+    Breathing.value      = AMBX_MODE_BREATHING;
+    Breathing.flags      = MODE_FLAG_HAS_SPEED | MODE_FLAG_HAS_MODE_SPECIFIC_COLOR;
+    Breathing.speed_min  = AMBX_SPEED_SLOWEST;
+    Breathing.speed_max  = AMBX_SPEED_FASTEST;
+    Breathing.speed      = AMBX_SPEED_NORMAL;
+    Breathing.colors_min = 1;
+    Breathing.colors_max = 1;
+    Breathing.color_mode = MODE_COLORS_MODE_SPECIFIC;
+    Breathing.colors.resize(1);
+    Breathing.colors[0]  = ToRGBColor(255, 255, 255);
+    modes.push_back(Breathing);
+    
+    mode SpectrumCycle;
+    SpectrumCycle.name       = "Spectrum Cycle";
+    SpectrumCycle.value      = AMBX_MODE_SPECTRUM_CYCLE;
+    SpectrumCycle.flags      = MODE_FLAG_HAS_SPEED;
+    SpectrumCycle.speed_min  = AMBX_SPEED_SLOWEST;
+    SpectrumCycle.speed_max  = AMBX_SPEED_FASTEST;
+    SpectrumCycle.speed      = AMBX_SPEED_NORMAL;
+    SpectrumCycle.color_mode = MODE_COLORS_NONE;
+    modes.push_back(SpectrumCycle);
+    
     // No additional controls needed - we're just handling lighting
 
     SetupZones();
@@ -70,6 +102,12 @@ RGBController_AMBX::~RGBController_AMBX()
     {
         amBX_device_count--;
     }
+    
+    // Writer threads flush the trace as they run, the last device writes out the rest
+    if(amBX_device_count == 0)
+    {
+        AMBXTrace::Flush();
+    }
 }
 
 void RGBController_AMBX::SetupZones()
@@ -139,12 +177,14 @@ void RGBController_AMBX::ResizeZone(int /*zone*/, int /*new_size*/)
 
 void RGBController_AMBX::DeviceUpdateLEDs()
 {
-    if(!controller->IsInitialized())
+    AMBX_TRACE_SCOPE("DeviceUpdateLEDs");
+    
+    if(!controller->IsInitialized() || modes[active_mode].value != AMBX_MODE_DIRECT)
     {
         return;
     }
     
-    // Use the batch update method for better performance
+    // Publish the frame, the controller's writer thread sends it
     unsigned int led_values[5];
     RGBColor led_colors[5];
     
@@ -154,12 +194,12 @@ void RGBController_AMBX::DeviceUpdateLEDs()
         led_colors[led_idx] = colors[led_idx];
     }
     
-    controller->SetLEDColors(led_values, led_colors, static_cast<unsigned int>(leds.size()));
+    controller->QueueLEDColors(led_values, led_colors, static_cast<unsigned int>(leds.size()));
 }
 
 void RGBController_AMBX::UpdateZoneLEDs(int zone)
 {
-    if(!controller->IsInitialized())
+    if(!controller->IsInitialized() || modes[active_mode].value != AMBX_MODE_DIRECT)
     {
         return;
     }
@@ -182,7 +222,7 @@ void RGBController_AMBX::UpdateZoneLEDs(int zone)
     }
     
     /*-------------------------------------------------*\
-    | Update LEDs in the zone with batch update         |
+    | Publish the LEDs in the zone                      |
     \*-------------------------------------------------*/
     unsigned int led_values[5];
     RGBColor led_colors[5];
@@ -194,19 +234,19 @@ void RGBController_AMBX::UpdateZoneLEDs(int zone)
         led_colors[led_idx] = colors[current_idx];
     }
     
-    controller->SetLEDColors(led_values, led_colors, zone_size);
+    controller->QueueLEDColors(led_values, led_colors, zone_size);
 }
 
 void RGBController_AMBX::UpdateSingleLED(int led)
 {
-    if(!controller->IsInitialized())
+    if(!controller->IsInitialized() || modes[active_mode].value != AMBX_MODE_DIRECT)
     {
         return;
     }
     
     unsigned int led_value = leds[led].value;
     RGBColor color = colors[led];
-    controller->SetLEDColor(led_value, color);
+    controller->QueueLEDColor(led_value, color);
 }
 
 void RGBController_AMBX::DeviceUpdateMode()
@@ -216,7 +256,55 @@ void RGBController_AMBX::DeviceUpdateMode()
         return;
     }
     
-    DeviceUpdateLEDs();
+    RGBColor     sequence[AMBX_SEQUENCE_STEPS];
+    unsigned int step_ms = AMBX_SPEED_STEP_TIME / std::max(modes[active_mode].speed, 1u);
+    
+    switch(modes[active_mode].value)
+    {
+        case AMBX_MODE_BREATHING:
+            {
+                /*-----------------------------------------*\
+                | One breath: fade up from off and back     |
+                \*-----------------------------------------*/
+                RGBColor color = modes[active_mode].colors[0];
+                
+                for(unsigned int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
+                {
+                    float level = (1.0f - std::cos((2.0f * 3.14159265f * (step + 1)) / AMBX_SEQUENCE_STEPS)) / 2.0f;
+                    
+                    sequence[step] = ToRGBColor((unsigned char)(RGBGetRValue(color) * level),
+                                                (unsigned char)(RGBGetGValue(color) * level),
+                                                (unsigned char)(RGBGetBValue(color) * level));
+                }
+                
+                controller->StartSequence(sequence, AMBX_SEQUENCE_STEPS, step_ms);
+            }
+            break;
+            
+        case AMBX_MODE_SPECTRUM_CYCLE:
+            {
+                /*-----------------------------------------*\
+                | One trip around the hue wheel             |
+                \*-----------------------------------------*/
+                for(unsigned int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
+                {
+                    hsv_t hsv;
+                    hsv.hue        = (step * 360) / AMBX_SEQUENCE_STEPS;
+                    hsv.saturation = 255;
+                    hsv.value      = 255;
+                    
+                    sequence[step] = hsv2rgb(&hsv);
+                }
+                
+                controller->StartSequence(sequence, AMBX_SEQUENCE_STEPS, step_ms);
+            }
+            break;
+            
+        default:
+            controller->StopSequence();
+            DeviceUpdateLEDs();
+            break;
+    }
 }
 
 
@@ -0,0 +1,253 @@
+/*---------------------------------------------------------*\
+| AMBXAllocationCounter.cpp                                 |
+|                                                           |
+|   Counting allocator for the amBX benchmark               |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXAllocationCounter.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long long> allocation_count(0);
+
+/*---------------------------------------------------------*\
+| Function: Get                                             |
+|                                                           |
+| Description: Reads the number of allocations so far       |
+|                                                           |
+| Returns: Allocations made since the program started       |
+\*---------------------------------------------------------*/
+unsigned long long AMBXAllocationCounter::Get()
+{
+    return allocation_count.load();
+}
+
+#ifdef __GLIBC__
+/*---------------------------------------------------------*\
+| glibc lets the program interpose its allocation functions,|
+| which every operator new goes through as well, aligned    |
+| and nothrow ones included                                 |
+\*---------------------------------------------------------*/
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    if((alignment < sizeof(void*)) || ((alignment & (alignment - 1)) != 0))
+    {
+        return EINVAL;
+    }
+    
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    
+    void* result = __libc_memalign(alignment, size);
+    
+    if(result == nullptr)
+    {
+        return ENOMEM;
+    }
+    
+    *ptr = result;
+    
+    return 0;
+}
+#else
+/*---------------------------------------------------------*\
+| Elsewhere every global operator new is replaced, along    |
+| with the operator delete that frees what it returns.      |
+| malloc itself is not counted. Aligned blocks are carved   |
+| out of a larger malloc block, with the pointer to free    |
+| stored just in front of them.                             |
+\*---------------------------------------------------------*/
+static void* CountedAlloc(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    
+    return std::malloc((size > 0) ? size : 1);
+}
+
+static void* CountedAlignedAlloc(std::size_t size, std::align_val_t alignment)
+{
+    std::size_t align = static_cast<std::size_t>(alignment);
+    
+    if(align < sizeof(void*))
+    {
+        align = sizeof(void*);
+    }
+    
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    
+    void* block = std::malloc(size + align + sizeof(void*));
+    
+    if(block == nullptr)
+    {
+        return nullptr;
+    }
+    
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(block) + sizeof(void*) + align - 1) & ~(std::uintptr_t)(align - 1);
+    
+    reinterpret_cast<void**>(aligned)[-1] = block;
+    
+    return reinterpret_cast<void*>(aligned);
+}
+
+static void CountedAlignedFree(void* ptr)
+{
+    if(ptr != nullptr)
+    {
+        std::free(static_cast<void**>(ptr)[-1]);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    void* ptr = CountedAlloc(size);
+    
+    if(ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    
+    return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    void* ptr = CountedAlignedAlloc(size, alignment);
+    
+    if(ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    
+    return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAlignedAlloc(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAlignedAlloc(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    CountedAlignedFree(ptr);
+}
+#endif
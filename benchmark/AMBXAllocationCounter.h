@@ -0,0 +1,18 @@
+/*---------------------------------------------------------*\
+| AMBXAllocationCounter.h                                   |
+|                                                           |
+|   Counts heap allocations made anywhere in the benchmark  |
+|   by replacing the allocator. Only built into the         |
+|   benchmark, with AMBX_COUNT_ALLOCATIONS defined.         |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+class AMBXAllocationCounter
+{
+public:
+    static unsigned long long   Get();
+};
@@ -0,0 +1,866 @@
+/*---------------------------------------------------------*\
+| AMBXBenchmark.cpp                                         |
+|                                                           |
+|   Update path benchmark for Philips amBX Gaming lights    |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXBenchmark.h"
+#include "AMBXController.h"
+#include "AMBXFrameBarrier.h"
+#include "AMBXFrameScheduler.h"
+#include "AMBXMockTransport.h"
+#include "AMBXTrace.h"
+#include "RGBController_AMBX.h"
+#include "AMBXLog.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#ifdef AMBX_COUNT_ALLOCATIONS
+#include "AMBXAllocationCounter.h"
+#endif
+
+static const char* benchmark_names[AMBX_BENCHMARK_COUNT] =
+{
+    "Static",
+    "Rainbow",
+    "Flicker",
+    "Multi-device",
+    "Multi-synced",
+    "Rainbow packed"
+};
+
+/*---------------------------------------------------------*\
+| State of one benchmarked device. Frame numbers are        |
+| carried in the red and green bytes of the marker light,   |
+| whose command is the last one sent for each frame.        |
+\*---------------------------------------------------------*/
+typedef struct
+{
+    AMBXMockTransport*                                  mock;
+    AMBXController*                                     controller;
+    RGBController_AMBX*                                 rgb;
+    unsigned int                                        marker_light;
+    std::vector<std::chrono::steady_clock::time_point>  publish_times;
+    std::vector<bool>                                   on_wire;
+    std::vector<std::chrono::steady_clock::time_point>  wire_times;
+    std::vector<double>                                 latencies;
+    std::vector<double>                                 publish_latencies;
+    unsigned int                                        frames_published;
+    unsigned long long                                  start_packets;
+    unsigned long long                                  start_frames_sent;
+    unsigned long long                                  start_skipped;
+    AMBXSchedulerStats                                  frame_jitter;
+} benchmark_device;
+
+static void BenchmarkPacketObserver(void* callback_arg, const unsigned char* packet, unsigned int size)
+{
+    benchmark_device* device = static_cast<benchmark_device*>(callback_arg);
+    
+    if(size < 6 || packet[2] != AMBX_SET_COLOR)
+    {
+        return;
+    }
+    
+    if(packet[1] != device->marker_light && packet[1] != AMBX_LIGHT_ALL)
+    {
+        return;
+    }
+    
+    unsigned int frame = packet[3] | (packet[4] << 8);
+    
+    if(frame == 0 || frame >= device->publish_times.size() || device->on_wire[frame])
+    {
+        return;
+    }
+    
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    
+    device->on_wire[frame]    = true;
+    device->wire_times[frame] = now;
+    device->latencies.push_back(std::chrono::duration<double, std::micro>(now - device->publish_times[frame]).count());
+}
+
+static void BuildFrame(unsigned int scenario, unsigned int frame, std::vector<RGBColor>& colors)
+{
+    for(std::size_t led_idx = 0; led_idx < colors.size(); led_idx++)
+    {
+        switch(scenario)
+        {
+            case AMBX_BENCHMARK_RAINBOW:
+            case AMBX_BENCHMARK_MULTI_DEVICE:
+            case AMBX_BENCHMARK_MULTI_SYNCED:
+            case AMBX_BENCHMARK_RAINBOW_PACKED:
+                colors[led_idx] = ToRGBColor((frame & 0xFF), ((frame >> 8) & 0xFF), ((frame + (led_idx * 51)) & 0xFF));
+                break;
+            
+            case AMBX_BENCHMARK_FLICKER:
+                colors[led_idx] = (led_idx == 0) ? ToRGBColor((frame & 0xFF), ((frame >> 8) & 0xFF), 0) : ToRGBColor(0, 0, 255);
+                break;
+            
+            default:
+                colors[led_idx] = ToRGBColor(0, 0, 255);
+                break;
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| State of the command stress. Each command carries its     |
+| thread and its number within that thread in the first     |
+| step's color, and is checked against the last number seen |
+| from the same thread.                                     |
+\*---------------------------------------------------------*/
+typedef struct
+{
+    unsigned int                    last_command[AMBX_BENCHMARK_STRESS_THREADS];
+    std::atomic<unsigned long long> delivered;
+    unsigned long long              duplicates;
+    unsigned long long              out_of_order;
+} stress_state;
+
+static void StressPacketObserver(void* callback_arg, const unsigned char* packet, unsigned int size)
+{
+    stress_state* state = static_cast<stress_state*>(callback_arg);
+    
+    if(size < AMBX_SEQUENCE_PACKET_SIZE || packet[2] != AMBX_SET_COLOR_SEQUENCE || packet[5] >= AMBX_BENCHMARK_STRESS_THREADS)
+    {
+        return;
+    }
+    
+    unsigned int thread  = packet[5];
+    unsigned int command = packet[6] | (packet[7] << 8) | (packet[3] << 16);
+    
+    if(command == state->last_command[thread])
+    {
+        state->duplicates++;
+    }
+    else if(command < state->last_command[thread])
+    {
+        state->out_of_order++;
+    }
+    
+    state->last_command[thread] = std::max(state->last_command[thread], command);
+    state->delivered.fetch_add(1, std::memory_order_release);
+}
+
+/*---------------------------------------------------------*\
+| Light ID check the lookup table replaced                  |
+\*---------------------------------------------------------*/
+static bool IsLightByChain(unsigned int light)
+{
+    return light == AMBX_LIGHT_LEFT ||
+           light == AMBX_LIGHT_RIGHT ||
+           light == AMBX_LIGHT_WALL_LEFT ||
+           light == AMBX_LIGHT_WALL_CENTER ||
+           light == AMBX_LIGHT_WALL_RIGHT ||
+           light == AMBX_LIGHT_ALL;
+}
+
+static double Percentile(std::vector<double>& values, double percentile)
+{
+    if(values.empty())
+    {
+        return 0.0;
+    }
+    
+    std::size_t index = std::min(values.size() - 1, (std::size_t)(percentile * values.size()));
+    
+    return values[index];
+}
+
+/*---------------------------------------------------------*\
+| Function: RunScenario                                      |
+|                                                           |
+| Description: Publishes frames at the target rate to fresh |
+|              mock devices and measures what reaches them  |
+|                                                           |
+| Parameters:                                               |
+|   scenario - One of the AMBX_BENCHMARK_* scenarios        |
+|                                                           |
+| Returns: The measured results                             |
+\*---------------------------------------------------------*/
+AMBXBenchmarkResult AMBXBenchmark::RunScenario(unsigned int scenario)
+{
+    AMBXBenchmarkResult result;
+    
+    scenario = std::min(scenario, (unsigned int)AMBX_BENCHMARK_COUNT - 1);
+    
+    bool         multi_device = (scenario == AMBX_BENCHMARK_MULTI_DEVICE || scenario == AMBX_BENCHMARK_MULTI_SYNCED);
+    unsigned int device_count = multi_device ? AMBX_BENCHMARK_MULTI_DEVICES : 1;
+    unsigned int max_frames   = ((AMBX_BENCHMARK_DURATION * AMBX_BENCHMARK_TARGET_FPS) / 1000) + 2;
+    
+    /*-----------------------------------------------------*\
+    | Set up mock devices behind the full driver stack      |
+    \*-----------------------------------------------------*/
+    std::vector<benchmark_device>     devices(device_count);
+    std::shared_ptr<AMBXFrameBarrier> barrier;
+    
+    if(scenario == AMBX_BENCHMARK_MULTI_SYNCED)
+    {
+        barrier = std::make_shared<AMBXFrameBarrier>();
+    }
+    
+    for(unsigned int device_idx = 0; device_idx < device_count; device_idx++)
+    {
+        benchmark_device& device = devices[device_idx];
+        std::string       name   = "Benchmark " + std::to_string(device_idx + 1);
+        
+        device.mock       = new AMBXMockTransport(name.c_str());
+        device.mock->SetLatency(AMBX_BENCHMARK_DEVICE_LATENCY, AMBX_BENCHMARK_DEVICE_JITTER);
+        device.controller = new AMBXController(device.mock, false, scenario == AMBX_BENCHMARK_RAINBOW_PACKED);
+        device.rgb        = new RGBController_AMBX(device.controller);
+        
+        if(barrier != nullptr)
+        {
+            device.controller->SetFrameBarrier(barrier);
+        }
+        
+        device.marker_light     = (scenario == AMBX_BENCHMARK_FLICKER) ? AMBX_LIGHT_LEFT : AMBX_LIGHT_WALL_RIGHT;
+        device.frames_published = 0;
+        device.publish_times.resize(max_frames);
+        device.on_wire.resize(max_frames, false);
+        device.wire_times.resize(max_frames);
+        device.latencies.reserve(max_frames);
+        device.publish_latencies.reserve(max_frames);
+    }
+    
+    // Let the initial blackout go out before measuring
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    
+    for(benchmark_device& device : devices)
+    {
+        device.start_packets     = device.mock->GetPacketCount();
+        device.start_frames_sent = device.controller->GetFramesSent();
+        device.start_skipped     = device.controller->GetPacketsSkipped();
+        device.mock->SetPacketObserver(BenchmarkPacketObserver, &device);
+    }
+    
+    /*-----------------------------------------------------*\
+    | Publish frames from one producer thread per device    |
+    \*-----------------------------------------------------*/
+    std::clock_t                          cpu_start = std::clock();
+    std::chrono::steady_clock::time_point start     = std::chrono::steady_clock::now();
+    std::vector<std::thread>              producers;
+    
+    /*-----------------------------------------------------*\
+    | Like OpenRGB's per-device update threads, producers   |
+    | run at the same rate but out of phase                 |
+    \*-----------------------------------------------------*/
+    for(unsigned int device_idx = 0; device_idx < device_count; device_idx++)
+    {
+        benchmark_device& device = devices[device_idx];
+        
+        producers.push_back(std::thread([&device, scenario, max_frames, start, device_idx, device_count]
+        {
+            const std::chrono::microseconds       frame_time(1000000 / AMBX_BENCHMARK_TARGET_FPS);
+            const std::chrono::microseconds       phase = (frame_time * device_idx) / device_count;
+            std::chrono::steady_clock::time_point end   = start + std::chrono::milliseconds(AMBX_BENCHMARK_DURATION);
+            AMBXFrameScheduler                    scheduler(AMBX_BENCHMARK_FRAME_SPIN);
+            
+            for(unsigned int frame = 1; frame < max_frames; frame++)
+            {
+                std::chrono::steady_clock::time_point deadline = start + phase + (frame_time * frame);
+                
+                if(deadline > end)
+                {
+                    break;
+                }
+                
+                scheduler.SleepUntil(deadline);
+                
+                BuildFrame(scenario, frame, device.rgb->colors);
+                
+                device.publish_times[frame] = std::chrono::steady_clock::now();
+                device.rgb->DeviceUpdateLEDs();
+                device.publish_latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - device.publish_times[frame]).count());
+                device.frames_published++;
+            }
+            
+            device.frame_jitter = scheduler.GetStats();
+        }));
+    }
+    
+    for(std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    
+    // Let the last frames reach the devices
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    
+    // Unhooking the observers waits for any that is running, after which its results can be read
+    for(benchmark_device& device : devices)
+    {
+        device.mock->SetPacketObserver(nullptr, nullptr);
+    }
+    
+    std::clock_t cpu_end = std::clock();
+    
+    /*-----------------------------------------------------*\
+    | Collect results and tear down                         |
+    \*-----------------------------------------------------*/
+    std::vector<double> latencies;
+    std::vector<double> publish_latencies;
+    unsigned long long  packets = 0;
+    unsigned long long  skipped = 0;
+    double              skew_total = 0.0;
+    unsigned int        skew_frames = 0;
+    
+    result.skew_max_us         = 0.0;
+    result.frame_jitter_p99_us = 0.0;
+    result.frame_jitter_max_us = 0.0;
+    
+    for(unsigned int frame = 1; multi_device && frame < max_frames; frame++)
+    {
+        std::chrono::steady_clock::time_point first = devices[0].wire_times[frame];
+        std::chrono::steady_clock::time_point last  = first;
+        bool                                  all   = true;
+        
+        for(benchmark_device& device : devices)
+        {
+            all   = all && device.on_wire[frame];
+            first = std::min(first, device.wire_times[frame]);
+            last  = std::max(last, device.wire_times[frame]);
+        }
+        
+        if(all)
+        {
+            double skew = std::chrono::duration<double, std::micro>(last - first).count();
+            
+            skew_total        += skew;
+            result.skew_max_us = std::max(result.skew_max_us, skew);
+            skew_frames++;
+        }
+    }
+    
+    // The barrier's own view of the skew, from transfer completions
+    result.barrier_stats = devices[0].controller->GetBarrierStats();
+    
+    result.scenario         = benchmark_names[scenario];
+    result.devices          = device_count;
+    result.frames_published = 0;
+    result.frames_on_wire   = 0;
+    result.frames_sent      = 0;
+    
+    for(benchmark_device& device : devices)
+    {
+        result.frame_jitter_p99_us = std::max(result.frame_jitter_p99_us, (double)device.frame_jitter.p99_us);
+        result.frame_jitter_max_us = std::max(result.frame_jitter_max_us, (double)device.frame_jitter.max_us);
+        
+        packets                 += device.mock->GetPacketCount() - device.start_packets;
+        skipped                 += device.controller->GetPacketsSkipped() - device.start_skipped;
+        result.frames_published += device.frames_published;
+        result.frames_on_wire   += (unsigned int)device.latencies.size();
+        result.frames_sent      += (unsigned int)(device.controller->GetFramesSent() - device.start_frames_sent);
+        latencies.insert(latencies.end(), device.latencies.begin(), device.latencies.end());
+        publish_latencies.insert(publish_latencies.end(), device.publish_latencies.begin(), device.publish_latencies.end());
+        
+        delete device.rgb;
+    }
+    
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(publish_latencies.begin(), publish_latencies.end());
+    
+    double frames = std::max(result.frames_published, 1u);
+    
+    result.sustained_fps     = (result.frames_on_wire * 1000.0) / (AMBX_BENCHMARK_DURATION * device_count);
+    result.published_fps     = (result.frames_published * 1000.0) / (AMBX_BENCHMARK_DURATION * device_count);
+    result.latency_p50_us    = Percentile(latencies, 0.50);
+    result.latency_p99_us    = Percentile(latencies, 0.99);
+    result.latency_p999_us   = Percentile(latencies, 0.999);
+    result.publish_p50_us    = Percentile(publish_latencies, 0.50);
+    result.publish_p99_us    = Percentile(publish_latencies, 0.99);
+    result.skipped_per_frame = (double)skipped / std::max(result.frames_sent, 1u);
+    result.packets_per_frame = packets / frames;
+    result.cpu_us_per_frame  = ((double)(cpu_end - cpu_start) * 1000000.0 / CLOCKS_PER_SEC) / frames;
+    result.skew_avg_us       = (skew_frames > 0) ? (skew_total / skew_frames) : 0.0;
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: RunCommandStress                                 |
+|                                                           |
+| Description: Hammers one mock device's command queue and  |
+|              frame mailbox from several threads at once   |
+|              and checks what reaches the device           |
+|                                                           |
+| Returns: The counts seen and whether the check passed     |
+\*---------------------------------------------------------*/
+AMBXStressResult AMBXBenchmark::RunCommandStress()
+{
+    AMBXStressResult result;
+    stress_state     state;
+    
+    for(unsigned int thread_idx = 0; thread_idx < AMBX_BENCHMARK_STRESS_THREADS; thread_idx++)
+    {
+        state.last_command[thread_idx] = 0;
+    }
+    
+    state.delivered    = 0;
+    state.duplicates   = 0;
+    state.out_of_order = 0;
+    
+    // The device is as fast as it can be so the queue, not the wire, is under test
+    AMBXMockTransport* mock = new AMBXMockTransport("Stress");
+    
+    mock->SetLatency(0, 0);
+    mock->SetEndpoint(AMBX_MOCK_PACKET_SIZE, 0);
+    
+    AMBXController* controller = new AMBXController(mock);
+    
+    controller->SetMinimumPacketGap(0);
+    
+    // Let the initial blackout go out before watching
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    
+    mock->SetPacketObserver(StressPacketObserver, &state);
+    
+    std::atomic<unsigned long long> queued(0);
+    std::atomic<unsigned long long> full(0);
+    std::vector<std::thread>        producers;
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    for(unsigned int thread_idx = 0; thread_idx < AMBX_BENCHMARK_STRESS_THREADS; thread_idx++)
+    {
+        producers.push_back(std::thread([controller, thread_idx, &queued, &full]
+        {
+            for(unsigned int command = 1; command <= AMBX_BENCHMARK_STRESS_COMMANDS; command++)
+            {
+                /*-----------------------------------------*\
+                | The command number rides in the step time |
+                | high byte and the first step's green and  |
+                | blue, the thread in its red               |
+                \*-----------------------------------------*/
+                RGBColor     marker  = ToRGBColor(thread_idx, (command & 0xFF), ((command >> 8) & 0xFF));
+                unsigned int step_ms = (command >> 16) << 8;
+                unsigned int light   = ((command & 1) != 0) ? AMBX_LIGHT_LEFT : AMBX_LIGHT_RIGHT;
+                RGBColor     frame   = ToRGBColor((command & 0xFF), thread_idx, 0);
+                
+                // Keep the ring full, retrying until the writer makes room
+                while(!controller->QueueColorSequence(light, step_ms, &marker, 1))
+                {
+                    full.fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                }
+                
+                queued.fetch_add(1, std::memory_order_relaxed);
+                
+                controller->QueueLEDColor(AMBX_LIGHT_WALL_CENTER, frame);
+            }
+        }));
+    }
+    
+    for(std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    
+    // Wait for the accepted commands to reach the device
+    std::chrono::steady_clock::time_point drain_deadline = end + std::chrono::milliseconds(AMBX_BENCHMARK_STRESS_DRAIN_TIMEOUT);
+    
+    while(state.delivered.load(std::memory_order_acquire) < queued.load() && std::chrono::steady_clock::now() < drain_deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    
+    mock->SetPacketObserver(nullptr, nullptr);
+    
+    result.threads      = AMBX_BENCHMARK_STRESS_THREADS;
+    result.queued       = queued.load();
+    result.full         = full.load();
+    result.delivered    = state.delivered.load(std::memory_order_acquire);
+    result.duplicates   = state.duplicates;
+    result.out_of_order = state.out_of_order;
+    result.commands_per_sec = result.queued / std::chrono::duration<double>(end - start).count();
+    result.passed       = (result.delivered == result.queued) && (result.duplicates == 0) && (result.out_of_order == 0);
+    
+    delete controller;
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: RunHaltRecovery                                  |
+|                                                           |
+| Description: Probes a mock device that stalls multi-      |
+|              command packets and stays halted until the   |
+|              halt is cleared, then checks that frames     |
+|              sent afterwards still reach it               |
+|                                                           |
+| Returns: What the probe settled on and whether the check  |
+|          passed                                           |
+\*---------------------------------------------------------*/
+AMBXHaltResult AMBXBenchmark::RunHaltRecovery()
+{
+    static unsigned int lights[AMBX_LIGHT_COUNT] =
+    {
+        AMBX_LIGHT_LEFT,
+        AMBX_LIGHT_RIGHT,
+        AMBX_LIGHT_WALL_LEFT,
+        AMBX_LIGHT_WALL_CENTER,
+        AMBX_LIGHT_WALL_RIGHT
+    };
+    
+    AMBXHaltResult result;
+    RGBColor       colors[AMBX_LIGHT_COUNT];
+    
+    AMBXMockTransport* mock = new AMBXMockTransport("Halt");
+    
+    mock->SetLatency(AMBX_BENCHMARK_DEVICE_LATENCY, AMBX_BENCHMARK_DEVICE_JITTER);
+    mock->SetMultiCommand(false);
+    
+    AMBXController* controller = new AMBXController(mock, false, true);
+    
+    for(unsigned int frame = 1; frame <= AMBX_BENCHMARK_HALT_FRAMES; frame++)
+    {
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            colors[slot] = ToRGBColor((frame & 0xFF), (slot * 51), 0x80);
+        }
+        
+        controller->QueueLEDColors(lights, colors, AMBX_LIGHT_COUNT);
+        
+        std::this_thread::sleep_for(std::chrono::microseconds(1000000 / AMBX_BENCHMARK_TARGET_FPS));
+    }
+    
+    // Wait for the last frame to reach every light
+    std::chrono::steady_clock::time_point drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(AMBX_BENCHMARK_HALT_DRAIN_TIMEOUT);
+    bool                                  delivered      = false;
+    
+    while(!delivered && std::chrono::steady_clock::now() < drain_deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        
+        delivered = true;
+        
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            delivered = delivered && (mock->GetLightState(lights[slot]).color == colors[slot]);
+        }
+    }
+    
+    result.commands_per_packet = controller->GetCommandsPerPacket();
+    result.stalls              = mock->GetErrorCount();
+    result.packets             = mock->GetPacketCount();
+    result.passed              = delivered && (result.stalls > 0) && (result.commands_per_packet == 1);
+    
+    delete controller;
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: RunAllocationCheck                               |
+|                                                           |
+| Description: Runs Rainbow frames through one mock device  |
+|              and counts heap allocations made anywhere    |
+|              once it has warmed up                        |
+|                                                           |
+| Returns: The allocations counted, or counted false if     |
+|          this build cannot count them                     |
+\*---------------------------------------------------------*/
+AMBXAllocationResult AMBXBenchmark::RunAllocationCheck()
+{
+    AMBXAllocationResult result;
+    
+    result.counted     = false;
+    result.frames      = 0;
+    result.packets     = 0;
+    result.allocations = 0;
+
+#ifdef AMBX_COUNT_ALLOCATIONS
+    AMBXMockTransport* mock = new AMBXMockTransport("Allocations");
+    
+    mock->SetLatency(AMBX_BENCHMARK_DEVICE_LATENCY, AMBX_BENCHMARK_DEVICE_JITTER);
+    
+    RGBController_AMBX* rgb = new RGBController_AMBX(new AMBXController(mock));
+    AMBXFrameScheduler  scheduler;
+    
+    const std::chrono::microseconds       frame_time(1000000 / AMBX_BENCHMARK_TARGET_FPS);
+    std::chrono::steady_clock::time_point start      = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point warmup_end = start + std::chrono::milliseconds(AMBX_BENCHMARK_ALLOC_WARMUP);
+    std::chrono::steady_clock::time_point end        = warmup_end + std::chrono::milliseconds(AMBX_BENCHMARK_ALLOC_DURATION);
+    
+    unsigned long long start_allocations = 0;
+    unsigned long long start_packets     = 0;
+    bool               counting          = false;
+    
+    for(unsigned int frame = 1; ; frame++)
+    {
+        std::chrono::steady_clock::time_point deadline = start + (frame_time * frame);
+        
+        if(deadline > end)
+        {
+            break;
+        }
+        
+        if(!counting && deadline >= warmup_end)
+        {
+            counting          = true;
+            start_packets     = mock->GetPacketCount();
+            start_allocations = AMBXAllocationCounter::Get();
+        }
+        
+        scheduler.SleepUntil(deadline);
+        
+        BuildFrame(AMBX_BENCHMARK_RAINBOW, frame, rgb->colors);
+        rgb->DeviceUpdateLEDs();
+        
+        if(counting)
+        {
+            result.frames++;
+        }
+    }
+    
+    result.allocations = AMBXAllocationCounter::Get() - start_allocations;
+    result.packets     = mock->GetPacketCount() - start_packets;
+    result.counted     = true;
+    
+    delete rgb;
+#endif
+
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: RunPacketBuild                                   |
+|                                                           |
+| Description: Times queueing a five light frame through    |
+|              QueueLEDColors, which checks its IDs against |
+|              the lookup table, checking them with the old |
+|              comparison chains and building its packets,  |
+|              then building it as a frame batch            |
+|                                                           |
+| Returns: Nanoseconds per frame for each                   |
+\*---------------------------------------------------------*/
+AMBXPacketBuildResult AMBXBenchmark::RunPacketBuild()
+{
+    AMBXPacketBuildResult result;
+    
+    result.frames = AMBX_BENCHMARK_BUILD_FRAMES;
+    
+    // Read through volatile so the checks cannot be hoisted out of the loop
+    volatile unsigned int lights[AMBX_LIGHT_COUNT];
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        lights[slot] = static_cast<unsigned int>(ambx_light_order[slot]);
+    }
+    
+    unsigned char packets[AMBX_LIGHT_COUNT][6];
+    unsigned int  checksum = 0;
+    
+    /*-----------------------------------------------------*\
+    | The driver checks each ID against the table once, in  |
+    | QueueLEDColors, and stores the colors in the mailbox. |
+    | The writer thread builds the packets, timed below as  |
+    | a frame batch.                                        |
+    \*-----------------------------------------------------*/
+    AMBXController* controller = new AMBXController(new AMBXMockTransport("Build"));
+    unsigned int    frame_lights[AMBX_LIGHT_COUNT];
+    RGBColor        frame_colors[AMBX_LIGHT_COUNT];
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        frame_lights[slot] = lights[slot];
+    }
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    for(unsigned int frame = 0; frame < AMBX_BENCHMARK_BUILD_FRAMES; frame++)
+    {
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            frame_colors[slot] = ToRGBColor(frame, slot, (frame >> 8));
+        }
+        
+        controller->QueueLEDColors(frame_lights, frame_colors, AMBX_LIGHT_COUNT);
+    }
+    
+    result.table_ns_per_frame = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / AMBX_BENCHMARK_BUILD_FRAMES;
+    
+    delete controller;
+    
+    // SetLEDColor and SetSingleColor each checked the ID, then the packet was built for it
+    start = std::chrono::steady_clock::now();
+    
+    for(unsigned int frame = 0; frame < AMBX_BENCHMARK_BUILD_FRAMES; frame++)
+    {
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            unsigned int light = lights[slot];
+            
+            if(IsLightByChain(light) && IsLightByChain(light))
+            {
+                AMBXController::BuildColorPacket(packets[slot], static_cast<AMBXLight>(light), ToRGBColor(frame, slot, (frame >> 8)));
+            }
+        }
+        
+        checksum += packets[frame % AMBX_LIGHT_COUNT][3];
+    }
+    
+    result.chain_ns_per_frame = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / AMBX_BENCHMARK_BUILD_FRAMES;
+    
+    // Slot colors come from the mailbox, read them through volatile for the same reason
+    volatile RGBColor slot_colors[AMBX_LIGHT_COUNT];
+    AMBXFrameBatch    batch;
+    
+    for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        slot_colors[slot] = ToRGBColor(slot, (slot * 2), (slot * 3));
+    }
+    
+    start = std::chrono::steady_clock::now();
+    
+    for(unsigned int frame = 0; frame < AMBX_BENCHMARK_BUILD_FRAMES; frame++)
+    {
+        RGBColor colors[AMBX_LIGHT_COUNT];
+        
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            colors[slot] = slot_colors[slot];
+        }
+        
+        AMBXController::BuildFrameBatch(batch, colors, (1 << AMBX_LIGHT_COUNT) - 1);
+        
+        checksum += batch.packets[frame % AMBX_LIGHT_COUNT][3];
+    }
+    
+    result.batch_ns_per_frame = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / AMBX_BENCHMARK_BUILD_FRAMES;
+    
+    // Keep the packets alive
+    volatile unsigned int sink = checksum;
+    (void)sink;
+    
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| Function: RunAll                                           |
+|                                                           |
+| Description: Runs every scenario and logs the results     |
+|                                                           |
+| Returns: false if the command stress, the halt recovery   |
+|          or the allocation check failed                   |
+\*---------------------------------------------------------*/
+bool AMBXBenchmark::RunAll()
+{
+    AMBX_LOG_INFO("[amBX benchmark] %d fps target, %d ms per scenario, %d us device latency",
+                  AMBX_BENCHMARK_TARGET_FPS, AMBX_BENCHMARK_DURATION, AMBX_BENCHMARK_DEVICE_LATENCY);
+    
+    for(unsigned int scenario = 0; scenario < AMBX_BENCHMARK_COUNT; scenario++)
+    {
+        AMBXBenchmarkResult result = RunScenario(scenario);
+        
+        /*-------------------------------------------------*\
+        | Nothing reaches the wire when every frame repeats |
+        | the last one, so there is no wire rate or latency |
+        | to report, only what publishing the frames cost   |
+        \*-------------------------------------------------*/
+        if(result.frames_on_wire == 0)
+        {
+            AMBX_LOG_INFO("[amBX benchmark] %-14s devices %u fps n/a latency n/a (all frames diffed away) published %.1f fps, %u frames reached the writer and skipped %.2f packets each, publish p50 %.1f us p99 %.1f us cpu %.1f us/frame frame jitter p99 %.0f us max %.0f us",
+                          result.scenario.c_str(),
+                          result.devices,
+                          result.published_fps,
+                          result.frames_sent,
+                          result.skipped_per_frame,
+                          result.publish_p50_us,
+                          result.publish_p99_us,
+                          result.cpu_us_per_frame,
+                          result.frame_jitter_p99_us,
+                          result.frame_jitter_max_us);
+            continue;
+        }
+        
+        AMBX_LOG_INFO("[amBX benchmark] %-14s devices %u fps %.1f latency p50 %.0f us p99 %.0f us p999 %.0f us publish p50 %.1f us p99 %.1f us packets/frame %.2f cpu %.1f us/frame skew avg %.0f us max %.0f us frame jitter p99 %.0f us max %.0f us",
+                      result.scenario.c_str(),
+                      result.devices,
+                      result.sustained_fps,
+                      result.latency_p50_us,
+                      result.latency_p99_us,
+                      result.latency_p999_us,
+                      result.publish_p50_us,
+                      result.publish_p99_us,
+                      result.packets_per_frame,
+                      result.cpu_us_per_frame,
+                      result.skew_avg_us,
+                      result.skew_max_us,
+                      result.frame_jitter_p99_us,
+                      result.frame_jitter_max_us);
+        
+        if(result.barrier_stats.frames_released > 0)
+        {
+            AMBX_LOG_INFO("[amBX benchmark] %-14s barrier released %llu frames, %llu timed out, skew avg %u us max %u us",
+                          result.scenario.c_str(),
+                          result.barrier_stats.frames_released,
+                          result.barrier_stats.timeouts,
+                          result.barrier_stats.average_skew_us,
+                          result.barrier_stats.max_skew_us);
+        }
+    }
+    
+    AMBXStressResult stress = RunCommandStress();
+    
+    if(stress.passed)
+    {
+        AMBX_LOG_INFO("[amBX benchmark] Command stress passed: threads %u queued %llu delivered %llu full %llu times, %.0f commands/s",
+                      stress.threads, stress.queued, stress.delivered, stress.full, stress.commands_per_sec);
+    }
+    else
+    {
+        AMBX_LOG_ERROR("[amBX benchmark] Command stress FAILED: threads %u queued %llu delivered %llu duplicates %llu out of order %llu",
+                       stress.threads, stress.queued, stress.delivered, stress.duplicates, stress.out_of_order);
+    }
+    
+    AMBXHaltResult halt = RunHaltRecovery();
+    
+    if(halt.passed)
+    {
+        AMBX_LOG_INFO("[amBX benchmark] Halt recovery passed: probe stalled %llu times, %u command per packet, %llu packets delivered after clearing the halt",
+                      halt.stalls, halt.commands_per_packet, halt.packets);
+    }
+    else
+    {
+        AMBX_LOG_ERROR("[amBX benchmark] Halt recovery FAILED: probe stalled %llu times, %u commands per packet, %llu packets delivered",
+                       halt.stalls, halt.commands_per_packet, halt.packets);
+    }
+    
+    AMBXPacketBuildResult build = RunPacketBuild();
+    
+    AMBX_LOG_INFO("[amBX benchmark] Packet build: %.1f ns per frame queued through the light table, %.1f ns checked with comparison chains and built per light, %.1f ns built as a frame batch",
+                  build.table_ns_per_frame, build.chain_ns_per_frame, build.batch_ns_per_frame);
+    
+    AMBXAllocationResult allocations = RunAllocationCheck();
+    
+    if(!allocations.counted)
+    {
+        AMBX_LOG_INFO("[amBX benchmark] Allocation check skipped, the benchmark was built with AMBX_COUNT_ALLOCATIONS off");
+    }
+    else if(allocations.allocations == 0)
+    {
+        AMBX_LOG_INFO("[amBX benchmark] Allocation check passed: no allocations over %u frames and %llu packets",
+                      allocations.frames, allocations.packets);
+    }
+    else
+    {
+        AMBX_LOG_ERROR("[amBX benchmark] Allocation check FAILED: %llu allocations over %u frames and %llu packets",
+                       allocations.allocations, allocations.frames, allocations.packets);
+    }
+    
+    // Benchmark runs are traced too when tracing is on
+    AMBXTrace::Flush();
+    
+    return stress.passed && halt.passed && allocations.allocations == 0;
+}
@@ -0,0 +1,199 @@
+/*---------------------------------------------------------*\
+| AMBXBenchmark.h                                           |
+|                                                           |
+|   Update path benchmark for Philips amBX Gaming lights    |
+|                                                           |
+|   Drives RGBController_AMBX::DeviceUpdateLEDs against     |
+|   mock devices and measures what reaches the simulated    |
+|   wire, then stress tests the command queue, checks that  |
+|   a halted endpoint recovers, checks that the update path |
+|   does not allocate and times building packets. Built as  |
+|   its own program against stand-ins for the OpenRGB       |
+|   headers, see CMakeLists.txt, so none of it ships in the |
+|   driver.                                                 |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include "AMBXFrameBarrier.h"
+#include <string>
+
+/*-----------------------------------------------------*\
+| Benchmark scenarios                                   |
+|                                                       |
+| Static         - Every frame is the same color        |
+| Rainbow        - Every light changes every frame      |
+| Flicker        - One light changes every frame        |
+| Multi-device   - Rainbow on several devices at once   |
+| Multi-synced   - Multi-device through a frame barrier |
+| Rainbow packed - Rainbow with multi-command packets   |
+\*-----------------------------------------------------*/
+enum
+{
+    AMBX_BENCHMARK_STATIC           = 0,
+    AMBX_BENCHMARK_RAINBOW          = 1,
+    AMBX_BENCHMARK_FLICKER          = 2,
+    AMBX_BENCHMARK_MULTI_DEVICE     = 3,
+    AMBX_BENCHMARK_MULTI_SYNCED     = 4,
+    AMBX_BENCHMARK_RAINBOW_PACKED   = 5,
+    AMBX_BENCHMARK_COUNT            = 6
+};
+
+/*-----------------------------------------------------*\
+| Each scenario publishes frames at the target rate for |
+| the duration (ms) to mock devices whose packets take  |
+| the given latency (us), about one interrupt interval. |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_DURATION             2000
+#define AMBX_BENCHMARK_TARGET_FPS           240
+#define AMBX_BENCHMARK_DEVICE_LATENCY       1000
+#define AMBX_BENCHMARK_DEVICE_JITTER        100
+#define AMBX_BENCHMARK_MULTI_DEVICES        4
+
+/*-----------------------------------------------------*\
+| Producers publish on absolute deadlines, busy-waiting |
+| this many us before each one                          |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_FRAME_SPIN           100
+
+/*-----------------------------------------------------*\
+| Results                                               |
+|                                                       |
+| Latency runs from DeviceUpdateLEDs to the simulated   |
+| device applying the last packet of the frame. Publish |
+| latency is how long DeviceUpdateLEDs itself took.     |
+| Frames sent counts the frames the writer threads took |
+| from the mailbox, and skipped the packets they left   |
+| out as the lights already had those colors. CPU time  |
+| is for the whole process, simulated devices included, |
+| divided by the frames published. Skew is the spread   |
+| in wire time of one frame across devices. Frame       |
+| jitter is how late producers woke up to publish, the  |
+| worst device's. Synced runs also report what the      |
+| frame barrier measured, as seen by the driver.        |
+\*-----------------------------------------------------*/
+typedef struct
+{
+    std::string     scenario;
+    unsigned int    devices;
+    unsigned int    frames_published;
+    unsigned int    frames_on_wire;
+    double          sustained_fps;
+    double          published_fps;
+    double          latency_p50_us;
+    double          latency_p99_us;
+    double          latency_p999_us;
+    double          publish_p50_us;
+    double          publish_p99_us;
+    unsigned int    frames_sent;
+    double          skipped_per_frame;
+    double          packets_per_frame;
+    double          cpu_us_per_frame;
+    double          skew_avg_us;
+    double          skew_max_us;
+    double          frame_jitter_p99_us;
+    double          frame_jitter_max_us;
+    AMBXBarrierStats barrier_stats;
+} AMBXBenchmarkResult;
+
+/*-----------------------------------------------------*\
+| Command stress                                        |
+|                                                       |
+| Several threads queue color sequences and publish     |
+| frames to one mock device as fast as they can,        |
+| retrying while the queue is full. Every command must  |
+| reach the device exactly once, and in the order its   |
+| thread queued it.                                     |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_STRESS_THREADS       4
+#define AMBX_BENCHMARK_STRESS_COMMANDS      2000
+#define AMBX_BENCHMARK_STRESS_DRAIN_TIMEOUT 2000
+
+typedef struct
+{
+    unsigned int        threads;
+    unsigned long long  queued;
+    unsigned long long  full;
+    unsigned long long  delivered;
+    unsigned long long  duplicates;
+    unsigned long long  out_of_order;
+    double              commands_per_sec;
+    bool                passed;
+} AMBXStressResult;
+
+/*-----------------------------------------------------*\
+| Halt recovery                                         |
+|                                                       |
+| A mock device whose firmware stalls multi-command     |
+| packets, and stays halted until the halt is cleared,  |
+| is probed for them and then sent frames. The probe    |
+| must be rejected and the last frame must still reach  |
+| every light.                                          |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_HALT_FRAMES          50
+#define AMBX_BENCHMARK_HALT_DRAIN_TIMEOUT   1000
+
+typedef struct
+{
+    unsigned int        commands_per_packet;
+    unsigned long long  stalls;
+    unsigned long long  packets;
+    bool                passed;
+} AMBXHaltResult;
+
+/*-----------------------------------------------------*\
+| Allocation check                                      |
+|                                                       |
+| Counts heap allocations anywhere in the process while |
+| one mock device runs Rainbow frames, after a warm up. |
+| The update path should make none. Counting replaces   |
+| the global allocator, see AMBXAllocationCounter.cpp,  |
+| and is on unless AMBX_COUNT_ALLOCATIONS is turned off |
+| when configuring the benchmark.                       |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_ALLOC_WARMUP         250
+#define AMBX_BENCHMARK_ALLOC_DURATION       1000
+
+typedef struct
+{
+    bool                counted;
+    unsigned int        frames;
+    unsigned long long  packets;
+    unsigned long long  allocations;
+} AMBXAllocationResult;
+
+/*-----------------------------------------------------*\
+| Packet build                                          |
+|                                                       |
+| Times queueing a five light frame through             |
+| QueueLEDColors on a mock device, which checks each ID |
+| once against the light lookup table and publishes the |
+| colors to the mailbox. Then times the comparison      |
+| chains the table replaced, which ran twice per light, |
+| with a SET_COLOR packet built for each light, and     |
+| building the frame as one AMBXFrameBatch from slot    |
+| colors, as the writer thread does.                    |
+\*-----------------------------------------------------*/
+#define AMBX_BENCHMARK_BUILD_FRAMES         1000000
+
+typedef struct
+{
+    unsigned int        frames;
+    double              table_ns_per_frame;
+    double              chain_ns_per_frame;
+    double              batch_ns_per_frame;
+} AMBXPacketBuildResult;
+
+class AMBXBenchmark
+{
+public:
+    static AMBXBenchmarkResult  RunScenario(unsigned int scenario);
+    static AMBXStressResult     RunCommandStress();
+    static AMBXHaltResult       RunHaltRecovery();
+    static AMBXAllocationResult RunAllocationCheck();
+    static AMBXPacketBuildResult RunPacketBuild();
+    static bool                 RunAll();
+};
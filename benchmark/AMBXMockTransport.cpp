@@ -0,0 +1,616 @@
+/*---------------------------------------------------------*\
+| AMBXMockTransport.cpp                                     |
+|                                                           |
+|   In-process mock of a Philips amBX Gaming lights device  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXMockTransport.h"
+#include "AMBXTrace.h"
+#include <algorithm>
+#include <cstring>
+
+/*---------------------------------------------------------*\
+| Returns the state slot of a light ID, or -1 if the ID is  |
+| not a single light                                        |
+\*---------------------------------------------------------*/
+static int GetMockLightSlot(unsigned int light)
+{
+    static const unsigned int mock_lights[AMBX_LIGHT_COUNT] =
+    {
+        AMBX_LIGHT_LEFT,
+        AMBX_LIGHT_RIGHT,
+        AMBX_LIGHT_WALL_LEFT,
+        AMBX_LIGHT_WALL_CENTER,
+        AMBX_LIGHT_WALL_RIGHT
+    };
+    
+    for(int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+    {
+        if(mock_lights[slot] == light)
+        {
+            return slot;
+        }
+    }
+    
+    return -1;
+}
+
+/*---------------------------------------------------------*\
+| Returns the size of the command at the start of data, or  |
+| 0 if it is not a whole command                            |
+\*---------------------------------------------------------*/
+static unsigned int GetMockCommandSize(const unsigned char* data, unsigned int size)
+{
+    unsigned int command_size;
+    
+    if(size < 3 || data[0] != AMBX_PACKET_HEADER)
+    {
+        return 0;
+    }
+    
+    switch(data[2])
+    {
+        case AMBX_SET_COLOR:
+            command_size = AMBX_COLOR_PACKET_SIZE;
+            break;
+        
+        case AMBX_SET_COLOR_SEQUENCE:
+            command_size = AMBX_SEQUENCE_PACKET_SIZE;
+            break;
+        
+        default:
+            return 0;
+    }
+    
+    return (size >= command_size) ? command_size : 0;
+}
+
+AMBXMockTransport::AMBXMockTransport(const char* name_ptr)
+{
+    name = name_ptr;
+    opened = false;
+    plugged = true;
+    endpoint.address = AMBX_ENDPOINT_OUT;
+    endpoint.max_packet_size = AMBX_MOCK_PACKET_SIZE;
+    endpoint.interval_us = AMBX_PACING_MIN_GAP;
+    device_thread_run = false;
+    queue_head = 0;
+    queue_count = 0;
+    
+    latency_us = AMBX_MOCK_DEFAULT_LATENCY;
+    jitter_us = 0;
+    error_rate = 0.0f;
+    error_status = LIBUSB_TRANSFER_TIMED_OUT;
+    multi_command = true;
+    halted = false;
+    observer = nullptr;
+    observer_arg = nullptr;
+    
+    packet_count = 0;
+    command_count = 0;
+    invalid_packet_count = 0;
+    error_count = 0;
+    
+    memset(lights, 0, sizeof(lights));
+}
+
+AMBXMockTransport::~AMBXMockTransport()
+{
+    Close();
+}
+
+/*---------------------------------------------------------*\
+| Function: Open                                             |
+|                                                           |
+| Description: Starts the simulated device                  |
+|                                                           |
+| Returns: true unless the device is unplugged              |
+\*---------------------------------------------------------*/
+bool AMBXMockTransport::Open()
+{
+    if(opened)
+    {
+        return true;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        
+        // Like a missing USB device, an unplugged one cannot be opened
+        if(!plugged)
+        {
+            return false;
+        }
+    }
+    
+    device_thread_run = true;
+    device_thread     = std::thread(&AMBXMockTransport::DeviceThreadFunction, this);
+    opened            = true;
+    
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| Function: Close                                            |
+|                                                           |
+| Description: Completes the packets still queued and stops |
+|              the simulated device                         |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::Close()
+{
+    if(!opened)
+    {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        device_thread_run = false;
+    }
+    
+    queue_cv.notify_all();
+    device_thread.join();
+    
+    opened = false;
+}
+
+/*---------------------------------------------------------*\
+| Function: Write                                            |
+|                                                           |
+| Description: Queues a packet for the simulated device,    |
+|              waiting if its queue is full                 |
+|                                                           |
+| Parameters:                                               |
+|   packet - Byte array containing the packet data          |
+|   size   - Size of the packet in bytes                    |
+|                                                           |
+| Returns: LIBUSB_SUCCESS or a libusb error code            |
+\*---------------------------------------------------------*/
+int AMBXMockTransport::Write(const unsigned char* packet, unsigned int size)
+{
+    if(!opened)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    // Like the USB transport, a halted endpoint is cleared before the next submit
+    int result = RecoverHalt();
+    
+    if(result != LIBUSB_SUCCESS)
+    {
+        return result;
+    }
+    
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    
+    // Like the USB transport, writes may be longer than the endpoint's packet size
+    if(size > AMBX_MOCK_PACKET_SIZE)
+    {
+        return LIBUSB_ERROR_OVERFLOW;
+    }
+    
+    if(!plugged)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    if(!queue_cv.wait_for(lock, std::chrono::milliseconds(AMBX_TRANSFER_TIMEOUT), [this]
+    {
+        return queue_count < AMBX_MOCK_QUEUE_DEPTH;
+    }))
+    {
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+    
+    mock_packet& queued = queue[(queue_head + queue_count) % AMBX_MOCK_QUEUE_DEPTH];
+    memcpy(queued.data, packet, size);
+    queued.size        = size;
+    queued.submit_time = std::chrono::steady_clock::now();
+    
+    queue_count++;
+    
+    lock.unlock();
+    queue_cv.notify_all();
+    
+    return LIBUSB_SUCCESS;
+}
+
+/*---------------------------------------------------------*\
+| Function: Read                                             |
+|                                                           |
+| Description: The simulated device never reports anything  |
+|              on its IN endpoint                           |
+|                                                           |
+| Returns: LIBUSB_ERROR_TIMEOUT after the timeout           |
+\*---------------------------------------------------------*/
+int AMBXMockTransport::Read(unsigned char* /*data*/, unsigned int /*size*/, unsigned int timeout_ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    
+    return LIBUSB_ERROR_TIMEOUT;
+}
+
+std::string AMBXMockTransport::GetLocation()
+{
+    return "Mock amBX: " + name;
+}
+
+std::string AMBXMockTransport::GetSerial()
+{
+    return "MOCK-" + name;
+}
+
+AMBXEndpointInfo AMBXMockTransport::GetOutEndpoint()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    return endpoint;
+}
+
+/*---------------------------------------------------------*\
+| Function: ClearHalt                                        |
+|                                                           |
+| Description: Clears a halt left by a stalled packet, so   |
+|              the simulated device takes packets again     |
+|                                                           |
+| Returns: LIBUSB_SUCCESS, or LIBUSB_ERROR_NO_DEVICE while  |
+|          unplugged                                        |
+\*---------------------------------------------------------*/
+int AMBXMockTransport::ClearHalt()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    if(!plugged)
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    
+    halted = false;
+    
+    return LIBUSB_SUCCESS;
+}
+
+void AMBXMockTransport::SetLatency(unsigned int new_latency_us, unsigned int new_jitter_us)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    latency_us = new_latency_us;
+    jitter_us  = new_jitter_us;
+}
+
+/*---------------------------------------------------------*\
+| Function: SetEndpoint                                      |
+|                                                           |
+| Description: Sets what the simulated OUT endpoint         |
+|              advertises. Takes effect for controllers     |
+|              created afterwards.                          |
+|                                                           |
+| Parameters:                                               |
+|   max_packet_size - wMaxPacketSize, at most               |
+|                     AMBX_MOCK_PACKET_SIZE                 |
+|   interval_us     - Polling interval in microseconds      |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::SetEndpoint(unsigned int max_packet_size, unsigned int interval_us)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    endpoint.max_packet_size = std::min(max_packet_size, (unsigned int)AMBX_MOCK_PACKET_SIZE);
+    endpoint.interval_us     = interval_us;
+}
+
+void AMBXMockTransport::SetErrorRate(float new_error_rate, libusb_transfer_status new_error_status)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    error_rate   = new_error_rate;
+    error_status = new_error_status;
+}
+
+/*---------------------------------------------------------*\
+| Function: SetMultiCommand                                  |
+|                                                           |
+| Description: Sets whether the simulated firmware takes    |
+|              several commands back to back in one packet. |
+|              Firmware that does not stalls such packets   |
+|              without applying any of them.                |
+|                                                           |
+| Parameters:                                               |
+|   new_multi_command - Whether packets may carry several   |
+|                       commands                            |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::SetMultiCommand(bool new_multi_command)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    
+    multi_command = new_multi_command;
+}
+
+void AMBXMockTransport::SetPacketObserver(AMBXMockPacketCallback callback, void* callback_arg)
+{
+    std::lock_guard<std::mutex> lock(observer_mutex);
+    
+    observer     = callback;
+    observer_arg = callback_arg;
+}
+
+/*---------------------------------------------------------*\
+| Function: SetPlugged                                       |
+|                                                           |
+| Description: Simulates the device being unplugged or      |
+|              plugged back in, reporting it like hotplug   |
+|                                                           |
+| Parameters:                                               |
+|   new_plugged - Whether the device is present             |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::SetPlugged(bool new_plugged)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        
+        if(plugged == new_plugged)
+        {
+            return;
+        }
+        
+        plugged = new_plugged;
+        
+        // A replugged device starts with its endpoint running
+        halted = false;
+    }
+    
+    if(!new_plugged)
+    {
+        std::lock_guard<std::mutex> state_lock(state_mutex);
+        
+        for(unsigned int slot = 0; slot < AMBX_LIGHT_COUNT; slot++)
+        {
+            lights[slot].color = ToRGBColor(0, 0, 0);
+        }
+    }
+    
+    ConnectionChanged(new_plugged);
+}
+
+AMBXMockLightState AMBXMockTransport::GetLightState(unsigned int light)
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    int slot = GetMockLightSlot(light);
+    
+    if(slot < 0)
+    {
+        AMBXMockLightState empty;
+        memset(&empty, 0, sizeof(empty));
+        return empty;
+    }
+    
+    return lights[slot];
+}
+
+unsigned long long AMBXMockTransport::GetPacketCount()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    return packet_count;
+}
+
+unsigned long long AMBXMockTransport::GetCommandCount()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    return command_count;
+}
+
+unsigned long long AMBXMockTransport::GetInvalidPacketCount()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    return invalid_packet_count;
+}
+
+unsigned long long AMBXMockTransport::GetErrorCount()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    return error_count;
+}
+
+/*---------------------------------------------------------*\
+| Function: DeviceThreadFunction                             |
+|                                                           |
+| Description: Serves queued packets in order, one at a     |
+|              time, like the device's OUT endpoint         |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::DeviceThreadFunction()
+{
+    AMBXTrace::SetThreadName("amBX mock device");
+    
+    std::chrono::steady_clock::time_point device_free = std::chrono::steady_clock::now();
+    std::uniform_real_distribution<float> error_distribution(0.0f, 1.0f);
+    
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    
+    while(true)
+    {
+        queue_cv.wait(lock, [this]
+        {
+            return queue_count > 0 || !device_thread_run;
+        });
+        
+        if(queue_count == 0)
+        {
+            break;
+        }
+        
+        /*-------------------------------------------------*\
+        | The packet stays queued until it completes so it  |
+        | counts against the queue depth while in flight    |
+        \*-------------------------------------------------*/
+        mock_packet            packet = queue[queue_head];
+        unsigned int           delay  = latency_us;
+        libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED;
+        
+        if(jitter_us > 0)
+        {
+            delay += random() % (jitter_us + 1);
+        }
+        
+        // Firmware without multi-command support stalls any packet carrying more than one command
+        unsigned int first_size = GetMockCommandSize(packet.data, packet.size);
+        
+        if(halted || (!multi_command && first_size != 0 && first_size < packet.size))
+        {
+            // The endpoint stays halted until the host clears it
+            status = LIBUSB_TRANSFER_STALL;
+            halted = true;
+        }
+        else if(error_rate > 0.0f && error_distribution(random) < error_rate)
+        {
+            status = error_status;
+        }
+        
+        lock.unlock();
+        
+        device_free = std::max(device_free, packet.submit_time) + std::chrono::microseconds(delay);
+        std::this_thread::sleep_until(device_free);
+        
+        if(status == LIBUSB_TRANSFER_COMPLETED)
+        {
+            ProcessPacket(packet.data, packet.size);
+            
+            std::lock_guard<std::mutex> observer_lock(observer_mutex);
+            
+            // The observer sees each command of the packet on its own
+            for(unsigned int offset = 0; observer != nullptr && offset < packet.size;)
+            {
+                unsigned int command_size = GetMockCommandSize(&packet.data[offset], packet.size - offset);
+                
+                if(command_size == 0)
+                {
+                    break;
+                }
+                
+                observer(observer_arg, &packet.data[offset], command_size);
+                offset += command_size;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> state_lock(state_mutex);
+            error_count++;
+        }
+        
+        Complete(packet.data, packet.size, status, std::chrono::steady_clock::now() - packet.submit_time);
+        
+        lock.lock();
+        queue_head = (queue_head + 1) % AMBX_MOCK_QUEUE_DEPTH;
+        queue_count--;
+        queue_cv.notify_all();
+    }
+}
+
+/*---------------------------------------------------------*\
+| Function: ProcessPacket                                    |
+|                                                           |
+| Description: Decodes the commands of a packet in order    |
+|              and applies them to the light state. An      |
+|              invalid command ends the packet, keeping the |
+|              commands before it.                          |
+|                                                           |
+| Parameters:                                               |
+|   packet - Byte array containing the packet data          |
+|   size   - Size of the packet in bytes                    |
+|                                                           |
+| Returns: None                                             |
+\*---------------------------------------------------------*/
+void AMBXMockTransport::ProcessPacket(const unsigned char* packet, unsigned int size)
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    
+    packet_count++;
+    
+    unsigned int offset = 0;
+    
+    do
+    {
+        unsigned int command_size = GetMockCommandSize(&packet[offset], size - offset);
+        
+        if(command_size == 0 || !ApplyCommand(&packet[offset]))
+        {
+            invalid_packet_count++;
+            return;
+        }
+        
+        command_count++;
+        offset += command_size;
+    } while(offset < size);
+}
+
+/*---------------------------------------------------------*\
+| Function: ApplyCommand                                     |
+|                                                           |
+| Description: Applies one whole command to the light state |
+|              with state_mutex held                        |
+|                                                           |
+| Parameters:                                               |
+|   command - The command, GetMockCommandSize bytes long    |
+|                                                           |
+| Returns: false if the command addresses no light          |
+\*---------------------------------------------------------*/
+bool AMBXMockTransport::ApplyCommand(const unsigned char* command)
+{
+    unsigned int light = command[1];
+    int          first = GetMockLightSlot(light);
+    int          last  = first;
+    
+    if(light == AMBX_LIGHT_ALL)
+    {
+        first = 0;
+        last  = AMBX_LIGHT_COUNT - 1;
+    }
+    else if(first < 0)
+    {
+        return false;
+    }
+    
+    if(command[2] == AMBX_SET_COLOR)
+    {
+        for(int slot = first; slot <= last; slot++)
+        {
+            lights[slot].color = ToRGBColor(command[3], command[4], command[5]);
+            lights[slot].color_writes++;
+        }
+        
+        return true;
+    }
+    
+    for(int slot = first; slot <= last; slot++)
+    {
+        for(unsigned int step = 0; step < AMBX_SEQUENCE_STEPS; step++)
+        {
+            const unsigned char* rgb = &command[5 + (step * 3)];
+            
+            lights[slot].sequence[step] = ToRGBColor(rgb[0], rgb[1], rgb[2]);
+        }
+        
+        // The light ends the sequence on its last step
+        lights[slot].sequence_step_ms = (command[3] << 8) | command[4];
+        lights[slot].color            = lights[slot].sequence[AMBX_SEQUENCE_STEPS - 1];
+        lights[slot].sequence_writes++;
+    }
+    
+    return true;
+}
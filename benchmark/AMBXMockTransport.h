@@ -0,0 +1,155 @@
+/*---------------------------------------------------------*\
+| AMBXMockTransport.h                                       |
+|                                                           |
+|   In-process mock of a Philips amBX Gaming lights device  |
+|                                                           |
+|   Decodes the 0xA1 packet format, one command or several  |
+|   back to back per packet, keeps the state of each light  |
+|   and completes writes on its own thread after a          |
+|   configurable latency with optional jitter and injected  |
+|   errors. Lets the driver be exercised and measured       |
+|   without the hardware.                                   |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include "RGBController.h"
+#include "AMBXController.h"
+#include "AMBXTransport.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+/*-----------------------------------------------------*\
+| Mock device limits                                    |
+|                                                       |
+| Writes block once AMBX_MOCK_QUEUE_DEPTH packets are   |
+| waiting, and are limited to AMBX_MOCK_PACKET_SIZE     |
+| bytes, matching the USB transfer pool.                |
+\*-----------------------------------------------------*/
+#define AMBX_MOCK_QUEUE_DEPTH               8
+#define AMBX_MOCK_PACKET_SIZE               64
+#define AMBX_MOCK_DEFAULT_LATENCY           1000
+
+/*-----------------------------------------------------*\
+| Observer called on the device thread for every        |
+| command the simulated device accepts, as it takes     |
+| effect                                                |
+\*-----------------------------------------------------*/
+typedef void (*AMBXMockPacketCallback)(void* callback_arg, const unsigned char* packet, unsigned int size);
+
+typedef struct
+{
+    RGBColor                color;
+    unsigned int            color_writes;
+    RGBColor                sequence[AMBX_SEQUENCE_STEPS];
+    unsigned int            sequence_step_ms;
+    unsigned int            sequence_writes;
+} AMBXMockLightState;
+
+class AMBXMockTransport : public AMBXTransport
+{
+public:
+    AMBXMockTransport(const char* name);
+    ~AMBXMockTransport();
+    
+    bool                    Open();
+    void                    Close();
+    
+    int                     Write(const unsigned char* packet, unsigned int size);
+    int                     Read(unsigned char* data, unsigned int size, unsigned int timeout_ms);
+    
+    std::string             GetLocation();
+    std::string             GetSerial();
+    AMBXEndpointInfo        GetOutEndpoint();
+    
+    /*-----------------------------------------------------*\
+    | Simulation settings                                   |
+    |                                                       |
+    | Each packet takes latency_us plus a uniformly random  |
+    | 0 to jitter_us to complete. A fraction error_rate of  |
+    | packets completes with error_status instead.          |
+    | Multi-command packets are taken unless turned off.    |
+    | A stalled packet halts the endpoint, stalling every   |
+    | packet after it until the halt is cleared.            |
+    \*-----------------------------------------------------*/
+    void                    SetLatency(unsigned int latency_us, unsigned int jitter_us);
+    void                    SetErrorRate(float error_rate, libusb_transfer_status error_status);
+    void                    SetMultiCommand(bool multi_command);
+    void                    SetPacketObserver(AMBXMockPacketCallback callback, void* callback_arg);
+    void                    SetEndpoint(unsigned int max_packet_size, unsigned int interval_us);
+    
+    /*-----------------------------------------------------*\
+    | Simulates unplugging and replugging the device. An    |
+    | unplugged device rejects writes and comes back dark.  |
+    \*-----------------------------------------------------*/
+    void                    SetPlugged(bool plugged);
+    
+    /*-----------------------------------------------------*\
+    | Device state                                          |
+    \*-----------------------------------------------------*/
+    AMBXMockLightState      GetLightState(unsigned int light);
+    unsigned long long      GetPacketCount();
+    unsigned long long      GetCommandCount();
+    unsigned long long      GetInvalidPacketCount();
+    unsigned long long      GetErrorCount();
+
+private:
+    typedef struct
+    {
+        unsigned char                           data[AMBX_MOCK_PACKET_SIZE];
+        unsigned int                            size;
+        std::chrono::steady_clock::time_point   submit_time;
+    } mock_packet;
+    
+    std::string                     name;
+    bool                            opened;
+    bool                            plugged;
+    AMBXEndpointInfo                endpoint;
+    
+    /*-----------------------------------------------------*\
+    | Fixed ring of queued packets so writes never allocate |
+    \*-----------------------------------------------------*/
+    mock_packet                     queue[AMBX_MOCK_QUEUE_DEPTH];
+    unsigned int                    queue_head;
+    unsigned int                    queue_count;
+    std::mutex                      queue_mutex;
+    std::condition_variable         queue_cv;
+    std::thread                     device_thread;
+    bool                            device_thread_run;
+    
+    unsigned int                    latency_us;
+    unsigned int                    jitter_us;
+    float                           error_rate;
+    libusb_transfer_status          error_status;
+    bool                            multi_command;
+    bool                            halted;
+    std::mt19937                    random;
+    
+    /*-----------------------------------------------------*\
+    | The observer is called under observer_mutex, so once  |
+    | SetPacketObserver returns the old one is not running  |
+    | and whatever it wrote is visible to the caller        |
+    \*-----------------------------------------------------*/
+    AMBXMockPacketCallback          observer;
+    void*                           observer_arg;
+    std::mutex                      observer_mutex;
+    
+    std::mutex                      state_mutex;
+    AMBXMockLightState              lights[AMBX_LIGHT_COUNT];
+    unsigned long long              packet_count;
+    unsigned long long              command_count;
+    unsigned long long              invalid_packet_count;
+    unsigned long long              error_count;
+    
+    int                     ClearHalt();
+    void                    DeviceThreadFunction();
+    void                    ProcessPacket(const unsigned char* packet, unsigned int size);
+    bool                    ApplyCommand(const unsigned char* command);
+};
@@ -0,0 +1,23 @@
+/*---------------------------------------------------------*\
+| main.cpp                                                  |
+|                                                           |
+|   Runs the update path benchmark for Philips amBX Gaming  |
+|   lights. An optional argument names a trace file to      |
+|   record the run to.                                      |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "AMBXBenchmark.h"
+#include "AMBXTrace.h"
+
+int main(int argc, char* argv[])
+{
+    if(argc > 1)
+    {
+        AMBXTrace::Enable(argv[1]);
+    }
+
+    return AMBXBenchmark::RunAll() ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+/*---------------------------------------------------------*\
+| LogManager.h                                              |
+|                                                           |
+|   Stand-in for OpenRGB's LogManager.h that prints to the  |
+|   console, for the amBX benchmark                         |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <cstdio>
+
+#define LOG_PRINT(...)      (printf(__VA_ARGS__), printf("\n"), fflush(stdout))
+
+#define LOG_FATAL(...)      LOG_PRINT(__VA_ARGS__)
+#define LOG_ERROR(...)      LOG_PRINT(__VA_ARGS__)
+#define LOG_WARNING(...)    LOG_PRINT(__VA_ARGS__)
+#define LOG_INFO(...)       LOG_PRINT(__VA_ARGS__)
+#define LOG_VERBOSE(...)    LOG_PRINT(__VA_ARGS__)
+#define LOG_DEBUG(...)      LOG_PRINT(__VA_ARGS__)
+#define LOG_TRACE(...)      LOG_PRINT(__VA_ARGS__)
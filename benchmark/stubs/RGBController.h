@@ -0,0 +1,121 @@
+/*---------------------------------------------------------*\
+| RGBController.h                                           |
+|                                                           |
+|   Stand-in for OpenRGB's RGBController.h, just enough of  |
+|   it to build the amBX driver into the benchmark          |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+typedef unsigned int RGBColor;
+
+#define RGBGetRValue(rgb)   (rgb & 0x000000FF)
+#define RGBGetGValue(rgb)   ((rgb >> 8) & 0x000000FF)
+#define RGBGetBValue(rgb)   ((rgb >> 16) & 0x000000FF)
+
+#define ToRGBColor(r, g, b) ((RGBColor)((b << 16) | (g << 8) | (r)))
+
+enum
+{
+    MODE_FLAG_HAS_SPEED                 = (1 << 0),
+    MODE_FLAG_HAS_PER_LED_COLOR         = (1 << 2),
+    MODE_FLAG_HAS_MODE_SPECIFIC_COLOR   = (1 << 3),
+};
+
+enum
+{
+    MODE_COLORS_NONE                    = 0,
+    MODE_COLORS_PER_LED                 = 1,
+    MODE_COLORS_MODE_SPECIFIC           = 2,
+};
+
+typedef int device_type;
+
+enum
+{
+    DEVICE_TYPE_ACCESSORY               = 13,
+};
+
+typedef int zone_type;
+
+enum
+{
+    ZONE_TYPE_LINEAR                    = 1,
+};
+
+typedef struct
+{
+    unsigned int    height;
+    unsigned int    width;
+    unsigned int*   map;
+} matrix_map_type;
+
+class mode
+{
+public:
+    std::string             name;
+    int                     value       = 0;
+    unsigned int            flags       = 0;
+    unsigned int            speed_min   = 0;
+    unsigned int            speed_max   = 0;
+    unsigned int            speed       = 0;
+    unsigned int            colors_min  = 0;
+    unsigned int            colors_max  = 0;
+    unsigned int            color_mode  = 0;
+    std::vector<RGBColor>   colors;
+};
+
+class led
+{
+public:
+    std::string             name;
+    unsigned int            value       = 0;
+};
+
+class zone
+{
+public:
+    std::string             name;
+    zone_type               type        = ZONE_TYPE_LINEAR;
+    unsigned int            leds_min    = 0;
+    unsigned int            leds_max    = 0;
+    unsigned int            leds_count  = 0;
+    matrix_map_type*        matrix_map  = nullptr;
+};
+
+class RGBController
+{
+public:
+    std::string             name;
+    std::string             vendor;
+    std::string             description;
+    std::string             version;
+    std::string             serial;
+    std::string             location;
+    device_type             type        = DEVICE_TYPE_ACCESSORY;
+    std::vector<led>        leds;
+    std::vector<zone>       zones;
+    std::vector<mode>       modes;
+    std::vector<RGBColor>   colors;
+    int                     active_mode = 0;
+
+    virtual ~RGBController() {}
+
+    void SetupColors()
+    {
+        colors.resize(leds.size());
+    }
+
+    virtual void SetupZones()                           = 0;
+    virtual void ResizeZone(int zone, int new_size)     = 0;
+    virtual void DeviceUpdateLEDs()                     = 0;
+    virtual void UpdateZoneLEDs(int zone)               = 0;
+    virtual void UpdateSingleLED(int led)               = 0;
+    virtual void DeviceUpdateMode()                     = 0;
+};
@@ -0,0 +1,49 @@
+/*---------------------------------------------------------*\
+| hsv.cpp                                                   |
+|                                                           |
+|   Stand-in for OpenRGB's hsv.cpp, for the amBX benchmark  |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "hsv.h"
+
+/*---------------------------------------------------------*\
+| Function: hsv2rgb                                         |
+|                                                           |
+| Description: Converts hue (0-359), saturation and value   |
+|              (0-255) to an RGB color                      |
+|                                                           |
+| Parameters:                                               |
+|   hsv - Color to convert                                  |
+|                                                           |
+| Returns: RGB color                                        |
+\*---------------------------------------------------------*/
+RGBColor hsv2rgb(hsv_t* hsv)
+{
+    unsigned int hue        = hsv->hue % 360;
+    unsigned int value      = hsv->value;
+    unsigned int chroma     = (value * hsv->saturation) / 255;
+    unsigned int sector     = hue / 60;
+    unsigned int remainder  = hue % 60;
+    unsigned int rising     = (chroma * remainder) / 60;
+    unsigned int falling    = chroma - rising;
+    unsigned int base       = value - chroma;
+
+    unsigned int red        = 0;
+    unsigned int green      = 0;
+    unsigned int blue       = 0;
+
+    switch(sector)
+    {
+        case 0: red = chroma;  green = rising;  break;
+        case 1: red = falling; green = chroma;  break;
+        case 2: green = chroma; blue = rising;  break;
+        case 3: green = falling; blue = chroma; break;
+        case 4: red = rising;  blue = chroma;   break;
+        default: red = chroma; blue = falling;  break;
+    }
+
+    return ToRGBColor((red + base), (green + base), (blue + base));
+}
@@ -0,0 +1,21 @@
+/*---------------------------------------------------------*\
+| hsv.h                                                     |
+|                                                           |
+|   Stand-in for OpenRGB's hsv.h, for the amBX benchmark    |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include "RGBController.h"
+
+typedef struct
+{
+    unsigned int    hue;
+    unsigned int    saturation;
+    unsigned int    value;
+} hsv_t;
+
+RGBColor hsv2rgb(hsv_t* hsv);
@@ -0,0 +1,180 @@
+/*---------------------------------------------------------*\
+| libusb.cpp                                                |
+|                                                           |
+|   Stand-in for libusb-1.0 that finds no devices, for      |
+|   building the amBX benchmark where libusb is not         |
+|   installed                                               |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#include "libusb.h"
+
+extern "C"
+{
+
+int libusb_init(libusb_context** /*ctx*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void libusb_exit(libusb_context* /*ctx*/)
+{
+}
+
+int libusb_has_capability(uint32_t /*capability*/)
+{
+    return 0;
+}
+
+const char* libusb_error_name(int /*error_code*/)
+{
+    return "LIBUSB_ERROR_NOT_SUPPORTED";
+}
+
+ssize_t libusb_get_device_list(libusb_context* /*ctx*/, libusb_device*** /*list*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void libusb_free_device_list(libusb_device** /*list*/, int /*unref_devices*/)
+{
+}
+
+libusb_device* libusb_ref_device(libusb_device* dev)
+{
+    return dev;
+}
+
+void libusb_unref_device(libusb_device* /*dev*/)
+{
+}
+
+int libusb_get_device_descriptor(libusb_device* /*dev*/, struct libusb_device_descriptor* /*desc*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_get_active_config_descriptor(libusb_device* /*dev*/, struct libusb_config_descriptor** /*config*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void libusb_free_config_descriptor(struct libusb_config_descriptor* /*config*/)
+{
+}
+
+uint8_t libusb_get_bus_number(libusb_device* /*dev*/)
+{
+    return 0;
+}
+
+uint8_t libusb_get_device_address(libusb_device* /*dev*/)
+{
+    return 0;
+}
+
+int libusb_get_port_numbers(libusb_device* /*dev*/, uint8_t* /*port_numbers*/, int /*port_numbers_len*/)
+{
+    return 0;
+}
+
+int libusb_get_device_speed(libusb_device* /*dev*/)
+{
+    return LIBUSB_SPEED_UNKNOWN;
+}
+
+int libusb_open(libusb_device* /*dev*/, libusb_device_handle** /*dev_handle*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void libusb_close(libusb_device_handle* /*dev_handle*/)
+{
+}
+
+libusb_device* libusb_get_device(libusb_device_handle* /*dev_handle*/)
+{
+    return nullptr;
+}
+
+int libusb_kernel_driver_active(libusb_device_handle* /*dev_handle*/, int /*interface_number*/)
+{
+    return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle* /*dev_handle*/, int /*interface_number*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_set_auto_detach_kernel_driver(libusb_device_handle* /*dev_handle*/, int /*enable*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_claim_interface(libusb_device_handle* /*dev_handle*/, int /*interface_number*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_release_interface(libusb_device_handle* /*dev_handle*/, int /*interface_number*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_clear_halt(libusb_device_handle* /*dev_handle*/, unsigned char /*endpoint*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle* /*dev_handle*/, uint8_t /*desc_index*/, unsigned char* /*data*/, int /*length*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_interrupt_transfer(libusb_device_handle* /*dev_handle*/, unsigned char /*endpoint*/, unsigned char* /*data*/, int /*length*/, int* /*actual_length*/, unsigned int /*timeout*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+struct libusb_transfer* libusb_alloc_transfer(int /*iso_packets*/)
+{
+    return new libusb_transfer();
+}
+
+void libusb_free_transfer(struct libusb_transfer* transfer)
+{
+    delete transfer;
+}
+
+int libusb_submit_transfer(struct libusb_transfer* /*transfer*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer* /*transfer*/)
+{
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_handle_events_timeout_completed(libusb_context* /*ctx*/, struct timeval* /*tv*/, int* /*completed*/)
+{
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_interrupt_event_handler(libusb_context* /*ctx*/)
+{
+}
+
+int libusb_hotplug_register_callback(libusb_context* /*ctx*/, int /*events*/, int /*flags*/, int /*vendor_id*/, int /*product_id*/, int /*dev_class*/, libusb_hotplug_callback_fn /*cb_fn*/, void* /*user_data*/, libusb_hotplug_callback_handle* /*callback_handle*/)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void libusb_hotplug_deregister_callback(libusb_context* /*ctx*/, libusb_hotplug_callback_handle /*callback_handle*/)
+{
+}
+
+}
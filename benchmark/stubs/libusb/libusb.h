@@ -0,0 +1,237 @@
+/*---------------------------------------------------------*\
+| libusb.h                                                  |
+|                                                           |
+|   Stand-in for the parts of libusb-1.0 the amBX driver    |
+|   uses, for building the benchmark where libusb is not    |
+|   installed. Every call fails or finds nothing, which is  |
+|   all the benchmark needs as it only talks to mock        |
+|   devices.                                                |
+|                                                           |
+|   This file is part of the OpenRGB project                |
+|   SPDX-License-Identifier: GPL-2.0-only                   |
+\*---------------------------------------------------------*/
+
+#pragma once
+
+#include <cstdint>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LIBUSB_CALL
+
+#define LIBUSB_ENDPOINT_IN                  0x80
+#define LIBUSB_ENDPOINT_DIR_MASK            0x80
+#define LIBUSB_TRANSFER_TYPE_MASK           0x03
+#define LIBUSB_HOTPLUG_MATCH_ANY            -1
+
+extern "C"
+{
+
+struct libusb_context;
+struct libusb_device;
+struct libusb_device_handle;
+
+enum libusb_error
+{
+    LIBUSB_SUCCESS                      = 0,
+    LIBUSB_ERROR_IO                     = -1,
+    LIBUSB_ERROR_INVALID_PARAM          = -2,
+    LIBUSB_ERROR_ACCESS                 = -3,
+    LIBUSB_ERROR_NO_DEVICE              = -4,
+    LIBUSB_ERROR_NOT_FOUND              = -5,
+    LIBUSB_ERROR_BUSY                   = -6,
+    LIBUSB_ERROR_TIMEOUT                = -7,
+    LIBUSB_ERROR_OVERFLOW               = -8,
+    LIBUSB_ERROR_PIPE                   = -9,
+    LIBUSB_ERROR_INTERRUPTED            = -10,
+    LIBUSB_ERROR_NO_MEM                 = -11,
+    LIBUSB_ERROR_NOT_SUPPORTED          = -12,
+    LIBUSB_ERROR_OTHER                  = -99
+};
+
+enum libusb_transfer_status
+{
+    LIBUSB_TRANSFER_COMPLETED,
+    LIBUSB_TRANSFER_ERROR,
+    LIBUSB_TRANSFER_TIMED_OUT,
+    LIBUSB_TRANSFER_CANCELLED,
+    LIBUSB_TRANSFER_STALL,
+    LIBUSB_TRANSFER_NO_DEVICE,
+    LIBUSB_TRANSFER_OVERFLOW
+};
+
+enum libusb_transfer_type
+{
+    LIBUSB_TRANSFER_TYPE_INTERRUPT      = 3
+};
+
+enum libusb_speed
+{
+    LIBUSB_SPEED_UNKNOWN                = 0,
+    LIBUSB_SPEED_LOW                    = 1,
+    LIBUSB_SPEED_FULL                   = 2,
+    LIBUSB_SPEED_HIGH                   = 3,
+    LIBUSB_SPEED_SUPER                  = 4
+};
+
+enum libusb_capability
+{
+    LIBUSB_CAP_HAS_HOTPLUG              = 0x0001
+};
+
+typedef enum
+{
+    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = 0x01,
+    LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT    = 0x02
+} libusb_hotplug_event;
+
+typedef enum
+{
+    LIBUSB_HOTPLUG_NO_FLAGS             = 0,
+    LIBUSB_HOTPLUG_ENUMERATE            = 1
+} libusb_hotplug_flag;
+
+typedef int libusb_hotplug_callback_handle;
+typedef int (LIBUSB_CALL *libusb_hotplug_callback_fn)(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* user_data);
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer* transfer);
+
+struct libusb_transfer
+{
+    libusb_device_handle*       dev_handle;
+    uint8_t                     flags;
+    unsigned char               endpoint;
+    unsigned char               type;
+    unsigned int                timeout;
+    enum libusb_transfer_status status;
+    int                         length;
+    int                         actual_length;
+    libusb_transfer_cb_fn       callback;
+    void*                       user_data;
+    unsigned char*              buffer;
+    int                         num_iso_packets;
+};
+
+struct libusb_device_descriptor
+{
+    uint8_t     bLength;
+    uint8_t     bDescriptorType;
+    uint16_t    bcdUSB;
+    uint8_t     bDeviceClass;
+    uint8_t     bDeviceSubClass;
+    uint8_t     bDeviceProtocol;
+    uint8_t     bMaxPacketSize0;
+    uint16_t    idVendor;
+    uint16_t    idProduct;
+    uint16_t    bcdDevice;
+    uint8_t     iManufacturer;
+    uint8_t     iProduct;
+    uint8_t     iSerialNumber;
+    uint8_t     bNumConfigurations;
+};
+
+struct libusb_endpoint_descriptor
+{
+    uint8_t                 bLength;
+    uint8_t                 bDescriptorType;
+    uint8_t                 bEndpointAddress;
+    uint8_t                 bmAttributes;
+    uint16_t                wMaxPacketSize;
+    uint8_t                 bInterval;
+    uint8_t                 bRefresh;
+    uint8_t                 bSynchAddress;
+    const unsigned char*    extra;
+    int                     extra_length;
+};
+
+struct libusb_interface_descriptor
+{
+    uint8_t                                     bLength;
+    uint8_t                                     bDescriptorType;
+    uint8_t                                     bInterfaceNumber;
+    uint8_t                                     bAlternateSetting;
+    uint8_t                                     bNumEndpoints;
+    uint8_t                                     bInterfaceClass;
+    uint8_t                                     bInterfaceSubClass;
+    uint8_t                                     bInterfaceProtocol;
+    uint8_t                                     iInterface;
+    const struct libusb_endpoint_descriptor*    endpoint;
+    const unsigned char*                        extra;
+    int                                         extra_length;
+};
+
+struct libusb_interface
+{
+    const struct libusb_interface_descriptor*   altsetting;
+    int                                         num_altsetting;
+};
+
+struct libusb_config_descriptor
+{
+    uint8_t                         bLength;
+    uint8_t                         bDescriptorType;
+    uint16_t                        wTotalLength;
+    uint8_t                         bNumInterfaces;
+    uint8_t                         bConfigurationValue;
+    uint8_t                         iConfiguration;
+    uint8_t                         bmAttributes;
+    uint8_t                         MaxPower;
+    const struct libusb_interface*  interface;
+    const unsigned char*            extra;
+    int                             extra_length;
+};
+
+int                         libusb_init(libusb_context** ctx);
+void                        libusb_exit(libusb_context* ctx);
+int                         libusb_has_capability(uint32_t capability);
+const char*                 libusb_error_name(int error_code);
+
+ssize_t                     libusb_get_device_list(libusb_context* ctx, libusb_device*** list);
+void                        libusb_free_device_list(libusb_device** list, int unref_devices);
+libusb_device*              libusb_ref_device(libusb_device* dev);
+void                        libusb_unref_device(libusb_device* dev);
+int                         libusb_get_device_descriptor(libusb_device* dev, struct libusb_device_descriptor* desc);
+int                         libusb_get_active_config_descriptor(libusb_device* dev, struct libusb_config_descriptor** config);
+void                        libusb_free_config_descriptor(struct libusb_config_descriptor* config);
+uint8_t                     libusb_get_bus_number(libusb_device* dev);
+uint8_t                     libusb_get_device_address(libusb_device* dev);
+int                         libusb_get_port_numbers(libusb_device* dev, uint8_t* port_numbers, int port_numbers_len);
+int                         libusb_get_device_speed(libusb_device* dev);
+
+int                         libusb_open(libusb_device* dev, libusb_device_handle** dev_handle);
+void                        libusb_close(libusb_device_handle* dev_handle);
+libusb_device*              libusb_get_device(libusb_device_handle* dev_handle);
+int                         libusb_kernel_driver_active(libusb_device_handle* dev_handle, int interface_number);
+int                         libusb_detach_kernel_driver(libusb_device_handle* dev_handle, int interface_number);
+int                         libusb_set_auto_detach_kernel_driver(libusb_device_handle* dev_handle, int enable);
+int                         libusb_claim_interface(libusb_device_handle* dev_handle, int interface_number);
+int                         libusb_release_interface(libusb_device_handle* dev_handle, int interface_number);
+int                         libusb_clear_halt(libusb_device_handle* dev_handle, unsigned char endpoint);
+int                         libusb_get_string_descriptor_ascii(libusb_device_handle* dev_handle, uint8_t desc_index, unsigned char* data, int length);
+int                         libusb_interrupt_transfer(libusb_device_handle* dev_handle, unsigned char endpoint, unsigned char* data, int length, int* actual_length, unsigned int timeout);
+
+struct libusb_transfer*     libusb_alloc_transfer(int iso_packets);
+void                        libusb_free_transfer(struct libusb_transfer* transfer);
+int                         libusb_submit_transfer(struct libusb_transfer* transfer);
+int                         libusb_cancel_transfer(struct libusb_transfer* transfer);
+
+int                         libusb_handle_events_timeout_completed(libusb_context* ctx, struct timeval* tv, int* completed);
+void                        libusb_interrupt_event_handler(libusb_context* ctx);
+
+int                         libusb_hotplug_register_callback(libusb_context* ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void* user_data, libusb_hotplug_callback_handle* callback_handle);
+void                        libusb_hotplug_deregister_callback(libusb_context* ctx, libusb_hotplug_callback_handle callback_handle);
+
+static inline void libusb_fill_interrupt_transfer(struct libusb_transfer* transfer, libusb_device_handle* dev_handle, unsigned char endpoint, unsigned char* buffer, int length, libusb_transfer_cb_fn callback, void* user_data, unsigned int timeout)
+{
+    transfer->dev_handle    = dev_handle;
+    transfer->endpoint      = endpoint;
+    transfer->type          = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+    transfer->timeout       = timeout;
+    transfer->buffer        = buffer;
+    transfer->length        = length;
+    transfer->user_data     = user_data;
+    transfer->callback      = callback;
+}
+
+}